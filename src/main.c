@@ -21,6 +21,7 @@
 #endif
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <glib.h>
 
@@ -28,18 +29,39 @@
 #include <glib/gi18n.h>
 
 #include "ofono-wizard.h"
+#include "mobile-provider.h"
 
 gint
 main (gint argc, gchar **argv)
 {
 	OfonoWizard *wizard;
+	MobileProviderDatabase *db;
 	GOptionContext *context;
 	GError *error = NULL;
 	gchar *path = NULL;
+	gchar *bus = NULL;
+	GBusType bus_type = G_BUS_TYPE_SYSTEM;
+	gchar **databases = NULL;
+	gboolean stats = FALSE;
+	/* G_MININT when not given, which keeps the wizard's defaults */
+	gint timeout = G_MININT;
+	gint deadline = G_MININT;
+	gboolean reactivate = FALSE;
 	gboolean success;
 
 	GOptionEntry entries[] = {
-		{ "path", 'p', 0, G_OPTION_ARG_STRING, &path, "Object path for the modem", "PATH" },
+		{ "path", 'p', 0, G_OPTION_ARG_STRING, &path, "Object path for the modem, lists the modems when missing", "PATH" },
+		{ "bus", 'b', 0, G_OPTION_ARG_STRING, &bus, "Bus oFono is on, system (default) or session", "BUS" },
+		{ "database", 'd', 0, G_OPTION_ARG_FILENAME_ARRAY, &databases,
+		  "Provider database, repeat to layer overlays in order", "FILE" },
+		{ "stats", 0, 0, G_OPTION_ARG_NONE, &stats,
+		  "Print the memory used by the provider database and exit", NULL },
+		{ "timeout", 't', 0, G_OPTION_ARG_INT, &timeout,
+		  "Milliseconds to wait for each oFono call (default 5000)", "MS" },
+		{ "deadline", 0, 0, G_OPTION_ARG_INT, &deadline,
+		  "Milliseconds to give up after while probing or applying, 0 for none (default 30000)", "MS" },
+		{ "reactivate", 'r', 0, G_OPTION_ARG_NONE, &reactivate,
+		  "Bring an active connection back up right after applying", NULL },
 		{ NULL }
 	};
 
@@ -55,19 +77,53 @@ main (gint argc, gchar **argv)
 		return 1;
 	}
 
-	if (path == NULL) {
-		g_warning (_("Provide a modem path.\n"));
-		exit (0);
+	if (g_strcmp0 (bus, "session") == 0)
+		bus_type = G_BUS_TYPE_SESSION;
+	else if (bus && strcmp (bus, "system")) {
+		g_warning ("Unknown bus '%s'", bus);
+		return 1;
+	}
+	g_free (bus);
+
+	if (timeout != G_MININT && timeout <= 0) {
+		g_warning ("Invalid timeout %d", timeout);
+		return 1;
+	}
+
+	if (deadline != G_MININT && deadline < 0) {
+		g_warning ("Invalid deadline %d", deadline);
+		return 1;
+	}
+
+	/* The service only knows about the default databases */
+	if (databases || stats)
+		db = mobile_provider_database_new_for_files ((const gchar * const *) databases,
+							     MOBILE_PROVIDER_DATABASE_FLAGS_NONE,
+							     &error);
+	else
+		db = mobile_provider_database_new (MOBILE_PROVIDER_DATABASE_FLAGS_USE_SERVICE, &error);
+	g_strfreev (databases);
+	if (db == NULL) {
+		g_warning ("Unable to load the mobile provider database: %s", error->message);
+		g_error_free (error);
+		return 1;
 	}
 
-	mobile_provider_init ();
+	if (stats) {
+		mobile_provider_database_print_stats (db);
+		mobile_provider_database_unref (db);
+		return 0;
+	}
 
-	wizard = ofono_wizard_new ();
+	wizard = ofono_wizard_new (db, bus_type);
+	ofono_wizard_set_timeouts (wizard, timeout, deadline);
+	ofono_wizard_set_reactivate (wizard, reactivate);
 	ofono_wizard_setup_modem (wizard, path);
 
 	gtk_main ();
 
-	mobile_provider_exit ();
+	g_object_unref (wizard);
+	mobile_provider_database_unref (db);
 
 	return 0;
 }
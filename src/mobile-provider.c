@@ -35,188 +35,556 @@
 
 #include <stdio.h>
 #include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
 
 #include "mobile-provider.h"
+#include "provider-database.h"
 
-/* Fixit: Determine the PREFIX from configure */
+/* Normally set by configure from mobile-broadband-provider-info.pc */
 #ifndef MOBILE_BROADBAND_PROVIDER_INFO
 #define MOBILE_BROADBAND_PROVIDER_INFO "/usr/share/mobile-broadband-provider-info/serviceproviders.xml"
 #endif
 
+/* Overlays shipped by the vendor, then the ones added on site */
+#ifndef PROVIDER_OVERLAY_VENDOR_DIR
+#define PROVIDER_OVERLAY_VENDOR_DIR "/usr/share/ofono-wizard/serviceproviders.d"
+#endif
+
+#ifndef PROVIDER_OVERLAY_SITE_DIR
+#define PROVIDER_OVERLAY_SITE_DIR "/etc/ofono-wizard/serviceproviders.d"
+#endif
+
+/* Bump whenever PROVIDER_CACHE_TYPE changes */
+#define PROVIDER_CACHE_VERSION 3
+#define PROVIDER_CACHE_TYPE "(ua(sxxt)a{ss}a(sa(sa(smsmsms)m(smsmsmsms))))"
+
 #define ISO_3166_COUNTRY_CODES "/usr/share/xml/iso-codes/iso_3166.xml"
 
+/* Lets provider-generator output be loaded with its own country list */
+#define ISO_3166_COUNTRY_CODES_ENV "MOBILE_PROVIDER_ISO_3166_CODES"
+
+/* Set to "gmarkup" to parse provider files with GMarkup only */
+#define SERVICE_XML_PARSER_ENV "MOBILE_PROVIDER_PARSER"
+
+/* Compressed files are decompressed and parsed this much at a time */
+#define PARSE_CHUNK_SIZE (64 * 1024)
+
+#define PROVIDER_DATABASE_SERVICE "org.ofono.wizard.ProviderDatabase"
+#define PROVIDER_DATABASE_PATH "/org/ofono/wizard/ProviderDatabase"
+
 typedef enum {
-  PARSER_TOPLEVEL = 0,
-  PARSER_COUNTRY,
-  PARSER_PROVIDER,
-  PARSER_METHOD_GSM,
-  PARSER_METHOD_GSM_APN,
-  PARSER_METHOD_CDMA,
-  PARSER_ERROR
+	PARSER_TOPLEVEL = 0,
+	PARSER_COUNTRY,
+	PARSER_PROVIDER,
+	PARSER_METHOD_GSM,
+	PARSER_METHOD_GSM_APN,
+	PARSER_METHOD_CDMA,
+	PARSER_ERROR
 } MobileContextState;
 
-MobileContextState servicexml_state = PARSER_TOPLEVEL;
+/* The serviceproviders.xml elements we act on */
+typedef enum {
+	ELEMENT_OTHER,
+	ELEMENT_SERVICEPROVIDERS,
+	ELEMENT_COUNTRY,
+	ELEMENT_PROVIDER,
+	ELEMENT_NAME,
+	ELEMENT_GSM,
+	ELEMENT_CDMA,
+	ELEMENT_NETWORK_ID,
+	ELEMENT_APN,
+	ELEMENT_USAGE,
+	ELEMENT_USERNAME,
+	ELEMENT_PASSWORD,
+	ELEMENT_MMSC,
+	ELEMENT_MMSPROXY
+} ServiceXmlElement;
+
+/* Offset into the database's string pool, POOL_NONE stands for NULL */
+#define POOL_NONE G_MAXUINT32
+
+/* A plan once the database is loaded, see mobile_provider_database_pack_plans */
+typedef struct {
+	guint32 name;
+	guint32 apn;
+	guint32 username;
+	guint32 password;
+} PlanRecord;
+
+typedef struct {
+	GHashTable *plans;		/* Plan Name (key) <--> Plan Info (value), while loading */
+	const gchar **plan_names;	/* sorted, into plans or the string pool */
+	PlanRecord *records;		/* packed plans, in plan_names order */
+	guint n_records;
+	PlanInfo *mms;			/* first MMS APN, if any */
+} Provider;
+
+typedef struct {
+	GHashTable *providers;		/* Provider Name (key) <--> Provider (value) */
+	const gchar **provider_names;	/* sorted, borrowed from providers */
+} Country;
+
+/* MCCs are three decimal digits, mcc_table is indexed by their value */
+#define MCC_TABLE_SIZE 1000
+
+typedef struct {
+	const gchar *code;		/* borrowed from mcc_info */
+	const gchar *name;		/* translated, set by translate_countries */
+} MccCountry;
+
+struct _MobileProviderDatabase {
+	gint ref_count;
+	MobileProviderDatabaseFlags flags;
+
+	/* Provider files, later ones override earlier ones */
+	gchar **files;
+
+	/*
+	 * MCC		(key) <--> country code (value)		: mcc_info
+	 * Country Code (key) <--> Country (value)		: country_info
+	 * Country Code (key) <--> ISO 3166 name (value)	: iso_names
+	 *
+	 * iso_names only has the countries with providers and keeps the
+	 * names untranslated. The translated names, and country_codes for
+	 * looking them up, are built on first use by translate_countries:
+	 * Country Name (key) <--> Country code (value)	: country_codes
+	 * Both borrow their strings from iso_names and the catalog.
+	 */
+	GHashTable *mcc_info;
+	GHashTable *country_info;
+	GHashTable *iso_names;
+	GHashTable *country_codes;
+	const gchar **country_names;
+
+	/* mcc_info flattened once loaded, NULL when using the service */
+	MccCountry *mcc_table;
+
+	/*
+	 * Every plan string, shared by the packed PlanRecords. PlanInfos
+	 * are only made for plans somebody asks for, and kept in plan_views
+	 * (guarded by lock) so they stay valid.
+	 */
+	gchar *pool;
+	gsize pool_size;
+	GHashTable *plan_views;
+
+	/*
+	 * When the provider database service is running, lookups are forwarded
+	 * to it and the replies are kept so the returned strings stay valid:
+	 * Country Code (key) <--> Provider names (value)	: remote_providers
+	 * Code/Provider(key) <--> Plan names (value)		: remote_plans
+	 * Code/Provider/Plan (key) <--> Plan Info (value)	: remote_plan_info
+	 * Code/Provider (key) <--> MMS Info or NULL (value)	: remote_mms_info
+	 *
+	 * Everything below is filled on demand and guarded by lock, the
+	 * tables above never change once the database is loaded.
+	 *
+	 * If the service fails, the files are parsed into local, a database
+	 * of its own, and lookups go there from then on.
+	 */
+	gboolean remote;
+	GMutex lock;
+	ProviderDatabase *service;
+	MobileProviderDatabase *local;
+	GHashTable *remote_providers;
+	GHashTable *remote_plans;
+	GHashTable *remote_plan_info;
+	GHashTable *remote_mms_info;
+
+	/* File contents and cache images held while loading, see get_stats */
+	gsize input_usage;
+	gsize input_peak;
+};
 
-static char *servicexml_text_buffer = NULL;
+/* Per-parse state, so several databases can load at the same time */
+typedef struct {
+	MobileProviderDatabase *db;
+	MobileContextState state;
+
+	char *text_buffer;
+	char *current_country_code;
+	char *current_provider_name;
+	char *current_apn;
+	char *current_plan_name;
+	char *current_username;
+	char *current_password;
+	char *current_usage;
+	char *current_mmsc;
+	char *current_mmsproxy;
+
+	GHashTable *plan_info;
+	GHashTable *provider_info;
+	PlanInfo *mms_info;
+
+	/* MCCs seen in this file, the first country claiming one wins */
+	GHashTable *mccs;
+
+	/* Where parsed countries and MCCs go, the database's or a worker's own */
+	GHashTable *country_info;
+	GHashTable *mcc_info;
+} ServiceXmlParser;
+
+GQuark
+mobile_provider_error_quark (void)
+{
+	return g_quark_from_static_string ("mobile-provider-error-quark");
+}
 
-static char *servicexml_current_country_code = NULL;
+static int
+compare_strings (const void *a, const void *b)
+{
+	return strcmp (*(const char **) a, *(const char **) b);
+}
 
-static char *servicexml_current_provider_name = NULL;
+typedef struct {
+	const gchar *name;
+	gchar *collation_key;
+} SortEntry;
 
-static char *servicexml_current_apn = NULL;
-static char *servicexml_current_plan_name = NULL;
-static char *servicexml_current_username = NULL;
-static char *servicexml_current_password = NULL;
+static int
+compare_sort_entries (const void *a, const void *b)
+{
+	return strcmp (((const SortEntry *) a)->collation_key,
+		       ((const SortEntry *) b)->collation_key);
+}
 
 /*
- * MCC		(key) <--> country code (value)		: mcc_info
- * Country Code (key) <--> Hash of Providers (value)	: country_info
- * Provider Name(key) <--> Hash of Plans (value)	: provider_info
- * Plan Name	(key) <--> Hash of Plan Info (value)	: plan_info
-*/
-static GHashTable *mcc_info = NULL;
-static GHashTable *plan_info = NULL;
-static GHashTable *provider_info = NULL;
-static GHashTable *country_info = NULL;
+ * Sort names in the current locale's order. Names are collated once
+ * each, so this is only done when a list is built, never per lookup.
+ */
+static void
+sort_names (const gchar **names, guint n_names)
+{
+	SortEntry *entries;
+	guint i;
+
+	if (n_names < 2)
+		return;
 
-/* Country Name (key) <--> Country codes (value)	: country_codes */
-static GHashTable *country_codes = NULL;
+	entries = g_new (SortEntry, n_names);
+	for (i = 0; i < n_names; i++) {
+		entries[i].name = names[i];
+		entries[i].collation_key = g_utf8_collate_key (names[i], -1);
+	}
+
+	qsort (entries, n_names, sizeof (SortEntry), compare_sort_entries);
+
+	for (i = 0; i < n_names; i++) {
+		names[i] = entries[i].name;
+		g_free (entries[i].collation_key);
+	}
+	g_free (entries);
+}
 
-static mobile_provider_table_destroy (gpointer data)
+/* NULL-terminated array of the table's keys, in order */
+static const gchar **
+sorted_keys (GHashTable *table)
 {
-	GHashTable *a = data;
+	GHashTableIter iter;
+	gpointer key;
+	const gchar **keys;
+	guint i = 0;
 
-	if (a == NULL)
-		return;
+	keys = g_new (const gchar *, g_hash_table_size (table) + 1);
+
+	g_hash_table_iter_init (&iter, table);
+	while (g_hash_table_iter_next (&iter, &key, NULL))
+		keys[i++] = key;
+	keys[i] = NULL;
 
-	g_hash_table_destroy (a);
+	sort_names (keys, i);
+
+	return keys;
 }
 
 static void
-servicexml_toplevel_start (const char *name,
-			   const char **attribute_names,
-			   const char **attribute_values)
+input_usage_add (MobileProviderDatabase *db, gsize bytes)
 {
-	int i;
+	db->input_usage += bytes;
+	if (db->input_usage > db->input_peak)
+		db->input_peak = db->input_usage;
+}
 
-	if (!strcmp (name, "serviceproviders")) {
-		for (i = 0; attribute_names && attribute_names[i]; i++) {
-			if (!strcmp (attribute_names[i], "format")) {
-				if (strcmp (attribute_values[i], "2.0")) {
-					g_warning ("%s: mobile broadband provider database format '%s'"
-					           " not supported.", __func__, attribute_values[i]);
-					servicexml_state = PARSER_ERROR;
-					break;
-				}
-			}
-		}
-	} else if (!strcmp (name, "country")) {
-		for (i = 0; attribute_names && attribute_names[i]; i++) {
-			if (!strcmp (attribute_names[i], "code")) {
-				char *country_code;
-				/* Directly use servicexml_current_country_code? */
-				country_code = g_ascii_strup (attribute_values[i], -1);
-				servicexml_current_country_code = country_code;
-
-				servicexml_state = PARSER_COUNTRY;
-				break;
-			}
-		}
-	}
+static void
+input_usage_remove (MobileProviderDatabase *db, gsize bytes)
+{
+	db->input_usage -= bytes;
 }
 
 static void
-servicexml_country_start (const char *name,
-			  const char **attribute_names,
-			  const char **attribute_values)
+servicexml_plan_info_free (gpointer user_data)
 {
-	if (!strcmp (name, "provider")) {
-		servicexml_state = PARSER_PROVIDER;
-	}
+	PlanInfo *info = user_data;
+	g_free ((gchar *) info->apn);
+	g_free ((gchar *) info->username);
+	g_free ((gchar *) info->password);
+	g_free ((gchar *) info->mmsc);
+	g_free ((gchar *) info->mmsproxy);
+
+	g_slice_free (PlanInfo, info);
+}
+
+/* Views only borrow from the string pool */
+static void
+plan_view_free (gpointer data)
+{
+	g_slice_free (PlanInfo, data);
+}
+
+/* Remembered misses are NULL */
+static void
+remote_plan_info_free (gpointer data)
+{
+	if (data)
+		servicexml_plan_info_free (data);
+}
+
+static void
+provider_free (gpointer data)
+{
+	Provider *provider = data;
+
+	if (provider->plans)
+		g_hash_table_destroy (provider->plans);
+	g_free (provider->plan_names);
+	g_free (provider->records);
+	if (provider->mms)
+		servicexml_plan_info_free (provider->mms);
+
+	g_slice_free (Provider, provider);
+}
+
+static void
+country_free (gpointer data)
+{
+	Country *country = data;
+
+	g_hash_table_destroy (country->providers);
+	g_free (country->provider_names);
+
+	g_slice_free (Country, country);
 }
 
+/* Plans from a later layer replace plans of the same name, same for MMS */
 static void
-servicexml_provider_start (const char *name,
-			   const char **attribute_names,
-			   const char **attribute_values)
+provider_merge (Provider *provider, Provider *layer)
 {
-	if (!strcmp (name, "gsm"))
-		servicexml_state = PARSER_METHOD_GSM;
-	else if (!strcmp (name, "cdma")) {
-		servicexml_state = PARSER_METHOD_CDMA;
+	GHashTableIter iter;
+	gpointer key, value;
+
+	g_hash_table_iter_init (&iter, layer->plans);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		g_hash_table_iter_steal (&iter);
+		g_hash_table_replace (provider->plans, key, value);
+	}
+
+	if (layer->mms) {
+		if (provider->mms)
+			servicexml_plan_info_free (provider->mms);
+		provider->mms = layer->mms;
+		layer->mms = NULL;
 	}
 }
 
 static void
-servicexml_gsm_start (const char *name,
-		      const char **attribute_names,
-		      const char **attribute_values)
+country_merge (Country *country, GHashTable *providers)
 {
-	if (!strcmp (name, "network-id")) {
-		const char *mcc = NULL;
-		int i;
+	GHashTableIter iter;
+	gpointer key, value;
+	Provider *existing;
 
-		for (i = 0; attribute_names && attribute_names[i]; i++) {
-			if (!strcmp (attribute_names[i], "mcc"))
-				mcc = attribute_values[i];
+	g_hash_table_iter_init (&iter, providers);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		g_hash_table_iter_steal (&iter);
 
-			if (mcc && strlen (mcc)) {
-				if (mcc_info == NULL) {
-					mcc_info = g_hash_table_new_full (g_str_hash, g_str_equal,
-							       (GDestroyNotify) g_free,
-							       (GDestroyNotify) g_free);
-				}
+		existing = g_hash_table_lookup (country->providers, key);
+		if (existing == NULL) {
+			g_hash_table_insert (country->providers, key, value);
+			continue;
+		}
 
-				gchar *code = g_hash_table_lookup (mcc_info, mcc);
-				if (code == NULL)
-					g_hash_table_insert (mcc_info, g_strdup(mcc), g_strdup (servicexml_current_country_code));
+		provider_merge (existing, value);
+		provider_free (value);
+		g_free (key);
+	}
+}
 
-				break;
-			}
+/*
+ * Element names are turned into tokens once, by length and first
+ * letter, so the state handlers below switch on a number instead of
+ * running strcmp chains.
+ */
+static ServiceXmlElement
+servicexml_element (const gchar *name, gsize length)
+{
+	switch (length) {
+	case 3:
+		if (!memcmp (name, "gsm", 3))
+			return ELEMENT_GSM;
+		if (!memcmp (name, "apn", 3))
+			return ELEMENT_APN;
+		break;
+	case 4:
+		switch (name[0]) {
+		case 'n':
+			if (!memcmp (name, "name", 4))
+				return ELEMENT_NAME;
+			break;
+		case 'c':
+			if (!memcmp (name, "cdma", 4))
+				return ELEMENT_CDMA;
+			break;
+		case 'm':
+			if (!memcmp (name, "mmsc", 4))
+				return ELEMENT_MMSC;
+			break;
+		}
+		break;
+	case 5:
+		if (!memcmp (name, "usage", 5))
+			return ELEMENT_USAGE;
+		break;
+	case 7:
+		if (!memcmp (name, "country", 7))
+			return ELEMENT_COUNTRY;
+		break;
+	case 8:
+		switch (name[0]) {
+		case 'p':
+			if (!memcmp (name, "provider", 8))
+				return ELEMENT_PROVIDER;
+			if (!memcmp (name, "password", 8))
+				return ELEMENT_PASSWORD;
+			break;
+		case 'u':
+			if (!memcmp (name, "username", 8))
+				return ELEMENT_USERNAME;
+			break;
+		case 'm':
+			if (!memcmp (name, "mmsproxy", 8))
+				return ELEMENT_MMSPROXY;
+			break;
 		}
-	} else if (!strcmp (name, "apn")) {
-		int i;
+		break;
+	case 10:
+		if (!memcmp (name, "network-id", 10))
+			return ELEMENT_NETWORK_ID;
+		break;
+	case 16:
+		if (!memcmp (name, "serviceproviders", 16))
+			return ELEMENT_SERVICEPROVIDERS;
+		break;
+	}
 
-		for (i = 0; attribute_names && attribute_names[i]; i++) {
-			if (!strcmp (attribute_names[i], "value")) {
-				servicexml_state = PARSER_METHOD_GSM_APN;
-				servicexml_current_apn = g_strstrip (g_strdup (attribute_values[i]));
-				break;
-			}
+	return ELEMENT_OTHER;
+}
+
+/* The one attribute we read from an element, NULL if none */
+static const gchar *
+servicexml_key_attribute (ServiceXmlElement element)
+{
+	switch (element) {
+	case ELEMENT_SERVICEPROVIDERS:
+		return "format";
+	case ELEMENT_COUNTRY:
+		return "code";
+	case ELEMENT_NETWORK_ID:
+		return "mcc";
+	case ELEMENT_APN:
+		return "value";
+	case ELEMENT_USAGE:
+		return "type";
+	default:
+		return NULL;
+	}
+}
+
+static void
+servicexml_toplevel_start (ServiceXmlParser *parser,
+			   ServiceXmlElement element,
+			   const gchar *key,
+			   GError **error)
+{
+	switch (element) {
+	case ELEMENT_SERVICEPROVIDERS:
+		if (key && strcmp (key, "2.0")) {
+			g_set_error (error, MOBILE_PROVIDER_ERROR,
+				     MOBILE_PROVIDER_ERROR_FORMAT,
+				     "mobile broadband provider database format '%s'"
+				     " not supported.", key);
+			parser->state = PARSER_ERROR;
+		}
+		break;
+	case ELEMENT_COUNTRY:
+		if (key) {
+			parser->current_country_code = g_ascii_strup (key, -1);
+			parser->state = PARSER_COUNTRY;
 		}
+		break;
+	default:
+		break;
 	}
 }
 
 static void
-servicexml_cdma_start (const char *name,
-                   const char **attribute_names,
-                   const char **attribute_values)
+servicexml_gsm_start (ServiceXmlParser *parser,
+		      ServiceXmlElement element,
+		      const gchar *key)
 {
-	return;
+	switch (element) {
+	case ELEMENT_NETWORK_ID:
+		/* Within a file the first country wins, across files the last one */
+		if (key && *key && !g_hash_table_contains (parser->mccs, key)) {
+			g_hash_table_add (parser->mccs, g_strdup (key));
+			g_hash_table_replace (parser->mcc_info, g_strdup (key),
+					      g_strdup (parser->current_country_code));
+		}
+		break;
+	case ELEMENT_APN:
+		if (key) {
+			parser->state = PARSER_METHOD_GSM_APN;
+			parser->current_apn = g_strstrip (g_strdup (key));
+		}
+		break;
+	default:
+		break;
+	}
 }
 
-void servicexml_start_element (GMarkupParseContext *context,
-			const gchar         *element_name,
-			const gchar        **attribute_names,
-			const gchar        **attribute_values,
-			gpointer             user_data,
-			GError             **error)
+/* key is the value of the element's servicexml_key_attribute */
+static void
+servicexml_start (ServiceXmlParser *parser,
+		  ServiceXmlElement element,
+		  const gchar *key,
+		  GError **error)
 {
-	switch (servicexml_state) {
+	switch (parser->state) {
 	case PARSER_TOPLEVEL:
-		servicexml_toplevel_start (element_name, attribute_names, attribute_values);
+		servicexml_toplevel_start (parser, element, key, error);
 		break;
 	case PARSER_COUNTRY:
-		servicexml_country_start (element_name, attribute_names, attribute_values);
+		if (element == ELEMENT_PROVIDER)
+			parser->state = PARSER_PROVIDER;
 		break;
 	case PARSER_PROVIDER:
-		servicexml_provider_start (element_name, attribute_names, attribute_values);
+		if (element == ELEMENT_GSM)
+			parser->state = PARSER_METHOD_GSM;
+		else if (element == ELEMENT_CDMA)
+			parser->state = PARSER_METHOD_CDMA;
 		break;
 	case PARSER_METHOD_GSM:
-		servicexml_gsm_start (element_name, attribute_names, attribute_values);
+		servicexml_gsm_start (parser, element, key);
 		break;
-	case PARSER_METHOD_CDMA:
-		servicexml_cdma_start (element_name, attribute_names, attribute_values);
+	case PARSER_METHOD_GSM_APN:
+		if (element == ELEMENT_USAGE && key) {
+			g_free (parser->current_usage);
+			parser->current_usage = g_strdup (key);
+		}
 		break;
 	default:
 		break;
@@ -224,168 +592,264 @@ void servicexml_start_element (GMarkupParseContext *context,
 }
 
 static void
-servicexml_country_end (const char *name)
+servicexml_start_element (GMarkupParseContext *context,
+			  const gchar         *element_name,
+			  const gchar        **attribute_names,
+			  const gchar        **attribute_values,
+			  gpointer             user_data,
+			  GError             **error)
 {
-	if (!strcmp (name, "country")) {
-		g_free (servicexml_text_buffer);
-		servicexml_text_buffer = NULL;
+	ServiceXmlElement element = servicexml_element (element_name, strlen (element_name));
+	const gchar *attribute = servicexml_key_attribute (element);
+	const gchar *key = NULL;
+	int i;
 
-		if (country_info == NULL) {
-			country_info = g_hash_table_new_full (g_str_hash, g_str_equal,
-							       (GDestroyNotify) g_free,
-							       (GDestroyNotify) mobile_provider_table_destroy);
+	for (i = 0; attribute && attribute_names && attribute_names[i]; i++) {
+		if (!strcmp (attribute_names[i], attribute)) {
+			key = attribute_values[i];
+			break;
 		}
+	}
+
+	servicexml_start (user_data, element, key, error);
+}
 
-		g_hash_table_insert (country_info, servicexml_current_country_code, provider_info);
+static void
+servicexml_country_end (ServiceXmlParser *parser, ServiceXmlElement element)
+{
+	Country *country;
+
+	if (element == ELEMENT_COUNTRY) {
+		g_free (parser->text_buffer);
+		parser->text_buffer = NULL;
+
+		country = g_hash_table_lookup (parser->country_info, parser->current_country_code);
 
-		servicexml_current_country_code = NULL;
-		provider_info = NULL;
+		if (parser->provider_info && country) {
+			/* Country from an earlier layer, merge into it */
+			country_merge (country, parser->provider_info);
+			g_hash_table_destroy (parser->provider_info);
+			g_free (parser->current_country_code);
+		} else if (parser->provider_info) {
+			country = g_slice_new0 (Country);
+			country->providers = parser->provider_info;
 
-		servicexml_state = PARSER_TOPLEVEL;
+			g_hash_table_insert (parser->country_info,
+					     parser->current_country_code, country);
+		} else
+			g_free (parser->current_country_code);
+
+		parser->current_country_code = NULL;
+		parser->provider_info = NULL;
+
+		parser->state = PARSER_TOPLEVEL;
 	}
 }
 
 static void
-servicexml_provider_end (const char *name)
+servicexml_provider_end (ServiceXmlParser *parser, ServiceXmlElement element)
 {
-	if (!strcmp (name, "name")) {
-		servicexml_current_provider_name = servicexml_text_buffer;
+	Provider *provider;
+
+	if (element == ELEMENT_NAME) {
+		g_free (parser->current_provider_name);
+		parser->current_provider_name = parser->text_buffer;
+
+		parser->text_buffer = NULL;
+	} else if (element == ELEMENT_PROVIDER) {
+		g_free (parser->text_buffer);
+		parser->text_buffer = NULL;
 
-		servicexml_text_buffer = NULL;
-	} else if (!strcmp (name, "provider")) {
-		g_free (servicexml_text_buffer);
-		servicexml_text_buffer = NULL;
+		if (parser->provider_info == NULL) {
+			parser->provider_info = g_hash_table_new_full (g_str_hash, g_str_equal,
+								       (GDestroyNotify) g_free,
+								       (GDestroyNotify) provider_free);
+		}
 
-		if (provider_info == NULL) {
-			provider_info = g_hash_table_new_full (g_str_hash, g_str_equal,
-							       (GDestroyNotify) g_free,
-							       (GDestroyNotify) mobile_provider_table_destroy);
+		if (parser->plan_info == NULL) {
+			parser->plan_info = g_hash_table_new_full (g_str_hash, g_str_equal,
+								   (GDestroyNotify) g_free,
+								   (GDestroyNotify) servicexml_plan_info_free);
 		}
 
-		g_hash_table_insert (provider_info, servicexml_current_provider_name, plan_info);
+		if (parser->current_provider_name) {
+			provider = g_slice_new0 (Provider);
+			provider->plans = parser->plan_info;
+			provider->mms = parser->mms_info;
+
+			g_hash_table_insert (parser->provider_info, parser->current_provider_name, provider);
+		} else {
+			g_hash_table_destroy (parser->plan_info);
+			if (parser->mms_info)
+				servicexml_plan_info_free (parser->mms_info);
+		}
 
-		servicexml_current_provider_name = NULL;
-		plan_info = NULL;
+		parser->current_provider_name = NULL;
+		parser->plan_info = NULL;
+		parser->mms_info = NULL;
 
-		servicexml_state = PARSER_COUNTRY;
+		parser->state = PARSER_COUNTRY;
 	}
 }
 
 static void
-servicexml_gsm_end (const char *name)
+servicexml_gsm_end (ServiceXmlParser *parser, ServiceXmlElement element)
 {
-	if (!strcmp (name, "gsm")) {
-		g_free (servicexml_text_buffer);
-		servicexml_text_buffer = NULL;
-		servicexml_state = PARSER_PROVIDER;
+	if (element == ELEMENT_GSM) {
+		g_free (parser->text_buffer);
+		parser->text_buffer = NULL;
+		parser->state = PARSER_PROVIDER;
 	}
 }
 
 static void
-servicexml_plan_info_free (gpointer user_data)
+servicexml_apn_end (ServiceXmlParser *parser)
 {
-	PlanInfo *info = user_data;
-	g_free (info->apn);
-	g_free (info->username);
-	g_free (info->password);
-
-	g_slice_free (PlanInfo, info);
-}
+	PlanInfo *info;
 
-static void
-servicexml_gsm_apn_end (const char *name)
-{
-	if (!strcmp (name, "name")) {
-		servicexml_current_plan_name = servicexml_text_buffer;
-		servicexml_text_buffer = NULL;
-	} else if (!strcmp (name, "username")) {
-		servicexml_current_username = servicexml_text_buffer;
-		servicexml_text_buffer = NULL;
-	} else if (!strcmp (name, "password")) {
-		servicexml_current_password = servicexml_text_buffer;
-		servicexml_text_buffer = NULL;
-	} else if (!strcmp (name, "apn")) {
-		if (plan_info == NULL) {
-			plan_info = g_hash_table_new_full (g_str_hash, g_str_equal,
+	if (parser->plan_info == NULL) {
+		parser->plan_info = g_hash_table_new_full (g_str_hash, g_str_equal,
 							   (GDestroyNotify) g_free,
 							   (GDestroyNotify) servicexml_plan_info_free);
-		}
+	}
 
-		PlanInfo *info = g_slice_new (PlanInfo);
-		info->apn	= servicexml_current_apn;
-		info->username	= servicexml_current_username;
-		info->password	= servicexml_current_password;
+	info = g_slice_new0 (PlanInfo);
+	info->apn	= parser->current_apn;
+	info->username	= parser->current_username;
+	info->password	= parser->current_password;
+
+	if (g_strcmp0 (parser->current_usage, "mms") == 0) {
+		info->mmsc	= parser->current_mmsc;
+		info->mmsproxy	= parser->current_mmsproxy;
+
+		parser->current_mmsc		= NULL;
+		parser->current_mmsproxy	= NULL;
+
+		/* A provider gets one MMS context, use the first APN */
+		if (parser->mms_info == NULL)
+			parser->mms_info = info;
+		else
+			servicexml_plan_info_free (info);
+
+		g_free (parser->current_plan_name);
+	} else if (parser->current_usage == NULL ||
+		   !strcmp (parser->current_usage, "internet")) {
+		if (parser->current_plan_name == NULL)
+			parser->current_plan_name = g_strdup ("Default");
+
+		g_hash_table_insert (parser->plan_info, parser->current_plan_name, info);
+	} else {
+		/* WAP and IMS APNs are not provisioned */
+		servicexml_plan_info_free (info);
+		g_free (parser->current_plan_name);
+	}
 
-		if (servicexml_current_plan_name == NULL)
-			servicexml_current_plan_name = g_strdup ("Default");
+	/*Create a apn table*/
+	g_free (parser->text_buffer);
+	g_free (parser->current_usage);
+	g_free (parser->current_mmsc);
+	g_free (parser->current_mmsproxy);
+	parser->text_buffer		= NULL;
 
-		g_hash_table_insert (plan_info, servicexml_current_plan_name, info);
+	parser->current_plan_name	= NULL;
 
-		/*Create a apn table*/
-		g_free (servicexml_text_buffer);
-		servicexml_text_buffer		= NULL;
+	parser->current_apn		= NULL;
+	parser->current_username	= NULL;
+	parser->current_password	= NULL;
+	parser->current_usage		= NULL;
+	parser->current_mmsc		= NULL;
+	parser->current_mmsproxy	= NULL;
 
-		servicexml_current_plan_name	= NULL;
+	parser->state = PARSER_METHOD_GSM;
+}
 
-		servicexml_current_apn		= NULL;
-		servicexml_current_username	= NULL;
-		servicexml_current_password	= NULL;
+static void
+servicexml_gsm_apn_end (ServiceXmlParser *parser, ServiceXmlElement element)
+{
+	gchar **field;
 
-		servicexml_state = PARSER_METHOD_GSM;
+	switch (element) {
+	case ELEMENT_NAME:
+		field = &parser->current_plan_name;
+		break;
+	case ELEMENT_USERNAME:
+		field = &parser->current_username;
+		break;
+	case ELEMENT_PASSWORD:
+		field = &parser->current_password;
+		break;
+	case ELEMENT_MMSC:
+		field = &parser->current_mmsc;
+		break;
+	case ELEMENT_MMSPROXY:
+		field = &parser->current_mmsproxy;
+		break;
+	case ELEMENT_APN:
+		servicexml_apn_end (parser);
+		return;
+	default:
+		return;
 	}
+
+	g_free (*field);
+	*field = parser->text_buffer;
+	parser->text_buffer = NULL;
 }
 
 static void
-servicexml_cdma_end (const char *name)
+servicexml_cdma_end (ServiceXmlParser *parser, ServiceXmlElement element)
 {
-	if (!strcmp (name, "username")) {
-	} else if (!strcmp (name, "password")) {
-	} else if (!strcmp (name, "dns")) {
-	} else if (!strcmp (name, "gateway")) {
-	} else if (!strcmp (name, "cdma")) {
-		g_free (servicexml_text_buffer);
-		servicexml_text_buffer = NULL;
-		servicexml_state = PARSER_PROVIDER;
+	if (element == ELEMENT_CDMA) {
+		g_free (parser->text_buffer);
+		parser->text_buffer = NULL;
+		parser->state = PARSER_PROVIDER;
 	}
 }
 
-void servicexml_end_element (GMarkupParseContext *context,
-			const gchar         *element_name,
-			gpointer             user_data,
-			GError             **error)
+static void
+servicexml_end (ServiceXmlParser *parser, ServiceXmlElement element)
 {
-
-	switch (servicexml_state) {
+	switch (parser->state) {
 	case PARSER_COUNTRY:
-		servicexml_country_end (element_name);
+		servicexml_country_end (parser, element);
 		break;
 	case PARSER_PROVIDER:
-		servicexml_provider_end (element_name);
+		servicexml_provider_end (parser, element);
 		break;
 	case PARSER_METHOD_GSM:
-		servicexml_gsm_end (element_name);
+		servicexml_gsm_end (parser, element);
 		break;
 	case PARSER_METHOD_GSM_APN:
-		servicexml_gsm_apn_end (element_name);
+		servicexml_gsm_apn_end (parser, element);
 		break;
 	case PARSER_METHOD_CDMA:
-		servicexml_cdma_end (element_name);
+		servicexml_cdma_end (parser, element);
 		break;
 	default:
 		break;
 	}
 }
 
-void servicexml_text (GMarkupParseContext *context,
-			const gchar         *text,
-			gsize                text_len,
+static void
+servicexml_end_element (GMarkupParseContext *context,
+			const gchar         *element_name,
 			gpointer             user_data,
 			GError             **error)
 {
-	if (servicexml_text_buffer)
-	  g_free (servicexml_text_buffer);
+	servicexml_end (user_data, servicexml_element (element_name, strlen (element_name)));
+}
+
+static void
+servicexml_text (GMarkupParseContext *context,
+		 const gchar         *text,
+		 gsize                text_len,
+		 gpointer             user_data,
+		 GError             **error)
+{
+	ServiceXmlParser *parser = user_data;
 
-	servicexml_text_buffer = g_strdup (text);
+	g_free (parser->text_buffer);
+	parser->text_buffer = g_strndup (text, text_len);
 }
 
 static GMarkupParser servicexmlparser = {
@@ -396,332 +860,2648 @@ static GMarkupParser servicexmlparser = {
 	NULL
 };
 
-/***** parse iso3166.xml *******/
+/* Drop whatever a failed parse left half-built */
 static void
-iso3166_start_element (GMarkupParseContext *context,
-                               const gchar *element_name,
-                               const gchar **attribute_names,
-                               const gchar **attribute_values,
-                               gpointer data,
-                               GError **error)
+servicexml_parser_clear (ServiceXmlParser *parser)
 {
-	int i;
-	const char *country_code = NULL;
-	const char *common_name = NULL;
-	const char *name = NULL;
-	const char *country_name = NULL;
-
-	if (!strcmp (element_name, "iso_3166_entry")) {
-		for (i = 0; attribute_names && attribute_names[i]; i++) {
-			if (!strcmp (attribute_names[i], "alpha_2_code"))
-				country_code = attribute_values[i];
-			else if (!strcmp (attribute_names[i], "common_name"))
-				common_name = attribute_values[i];
-			else if (!strcmp (attribute_names[i], "name"))
-				name = attribute_values[i];
-		}
-		if (!country_code) {
-			g_warning ("%s: missing mandatory 'alpha_2_code' atribute in '%s'"
-			           " element.", __func__, element_name);
-			return;
-		}
-		if (!name) {
-			g_warning ("%s: missing mandatory 'name' atribute in '%s'"
-			           " element.", __func__, element_name);
-			return;
-		}
-
-		if (country_codes == NULL) {
-			country_codes = g_hash_table_new_full (g_str_hash, g_str_equal,
-							   (GDestroyNotify) g_free,
-							   (GDestroyNotify) g_free);
-		}
+	g_free (parser->text_buffer);
+	g_free (parser->current_country_code);
+	g_free (parser->current_provider_name);
+	g_free (parser->current_apn);
+	g_free (parser->current_plan_name);
+	g_free (parser->current_username);
+	g_free (parser->current_password);
+	g_free (parser->current_usage);
+	g_free (parser->current_mmsc);
+	g_free (parser->current_mmsproxy);
+
+	if (parser->mms_info)
+		servicexml_plan_info_free (parser->mms_info);
+	if (parser->plan_info)
+		g_hash_table_destroy (parser->plan_info);
+	if (parser->provider_info)
+		g_hash_table_destroy (parser->provider_info);
+	if (parser->mccs)
+		g_hash_table_destroy (parser->mccs);
+
+	/* A worker's own tables, whatever wasn't merged */
+	if (parser->country_info && parser->country_info != parser->db->country_info)
+		g_hash_table_destroy (parser->country_info);
+	if (parser->mcc_info && parser->mcc_info != parser->db->mcc_info)
+		g_hash_table_destroy (parser->mcc_info);
+}
 
-		country_name = dgettext ("iso_3166", common_name ? common_name : name);
+static void
+servicexml_parser_init (ServiceXmlParser *parser, MobileProviderDatabase *db)
+{
+	memset (parser, 0, sizeof (ServiceXmlParser));
 
-		g_hash_table_insert (country_codes, g_strdup(country_name), g_strdup(country_code));
-	}
+	parser->db = db;
+	parser->mccs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	parser->country_info = db->country_info;
+	parser->mcc_info = db->mcc_info;
 }
 
-static GMarkupParser iso3166parser = {
-	iso3166_start_element,
-	NULL,
-	NULL,
-	NULL,
-	NULL
-};
-
-/***end of parser***/
+/* Parse into tables of the parser's own, see servicexml_parser_merge */
+static void
+servicexml_parser_init_private (ServiceXmlParser *parser, MobileProviderDatabase *db)
+{
+	servicexml_parser_init (parser, db);
+
+	parser->country_info = g_hash_table_new_full (g_str_hash, g_str_equal,
+						      (GDestroyNotify) g_free,
+						      (GDestroyNotify) country_free);
+	parser->mcc_info = g_hash_table_new_full (g_str_hash, g_str_equal,
+						  (GDestroyNotify) g_free,
+						  (GDestroyNotify) g_free);
+}
 
-gint
-mobile_provider_init ()
+/* Drop the state of an interrupted parse, the tables filled so far stay */
+static void
+servicexml_parser_reset (ServiceXmlParser *parser)
 {
-	gchar *contents;
-	gsize length;
-	GError *error;
-	GMarkupParseContext *servicexmlcontext;
-	GMarkupParseContext *iso3166context;
-
-	error = NULL;
-	if (!g_file_get_contents (MOBILE_BROADBAND_PROVIDER_INFO,
-				  &contents,
-				  &length,
-				  &error)) {
-		fprintf (stderr, "%s\n", error->message);
-		g_error_free (error);
-		return 1;
-	}
+	GHashTable *country_info = parser->country_info;
+	GHashTable *mcc_info = parser->mcc_info;
 
-	servicexmlcontext = g_markup_parse_context_new (&servicexmlparser, 0, NULL, NULL);
+	parser->country_info = NULL;
+	parser->mcc_info = NULL;
+	servicexml_parser_clear (parser);
 
-	if (!g_markup_parse_context_parse (servicexmlcontext, contents, length, NULL)) {
-		g_markup_parse_context_free (servicexmlcontext);
-		return 1;
-	}
+	servicexml_parser_init (parser, parser->db);
+	parser->country_info = country_info;
+	parser->mcc_info = mcc_info;
+}
 
-	if (!g_markup_parse_context_end_parse (servicexmlcontext, NULL)) {
-		g_markup_parse_context_free (servicexmlcontext);
-		return 1;
-	}
+/*
+ * Move what a parser with its own tables found into another parser's
+ * tables, the same as country_end and gsm_start would have done there.
+ */
+static void
+servicexml_parser_merge (ServiceXmlParser *into, ServiceXmlParser *parser)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	Country *existing;
 
-	g_markup_parse_context_free (servicexmlcontext);
-	g_free (contents);
+	g_hash_table_iter_init (&iter, parser->mcc_info);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		if (g_hash_table_contains (into->mccs, key))
+			continue;
 
-	/* parse iso3166 for the country names */
-	if (!g_file_get_contents (ISO_3166_COUNTRY_CODES,
-				  &contents,
-				  &length,
-				  &error)) {
-		fprintf (stderr, "%s\n", error->message);
-		g_error_free (error);
-		return 1;
+		g_hash_table_iter_steal (&iter);
+		g_hash_table_add (into->mccs, g_strdup (key));
+		g_hash_table_replace (into->mcc_info, key, value);
 	}
 
-	iso3166context = g_markup_parse_context_new (&iso3166parser, 0, NULL, NULL);
+	g_hash_table_iter_init (&iter, parser->country_info);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		g_hash_table_iter_steal (&iter);
 
-	if (!g_markup_parse_context_parse (iso3166context, contents, length, NULL)) {
-		g_markup_parse_context_free (iso3166context);
-		return 1;
-	}
+		existing = g_hash_table_lookup (into->country_info, key);
+		if (existing == NULL) {
+			g_hash_table_insert (into->country_info, key, value);
+			continue;
+		}
 
-	if (!g_markup_parse_context_end_parse (iso3166context, NULL)) {
-		g_markup_parse_context_free (iso3166context);
-		return 1;
+		country_merge (existing, ((Country *) value)->providers);
+		country_free (value);
+		g_free (key);
 	}
+}
 
-	g_markup_parse_context_free (iso3166context);
-	g_free (contents);
+/***** fast serviceproviders.xml scanner *******/
 
-	return 0;
-}
+/*
+ * GMarkup checks all of XML, but provider files are machine-written and
+ * use only a small part of it. Those files are scanned directly instead:
+ * memchr from tag to tag, and <cdma> subtrees skipped whole. The tables
+ * are still built by the servicexml callbacks above.
+ *
+ * The scanner gives up on anything it doesn't handle: CDATA, an internal
+ * DTD subset, unknown entities, mismatched tags or invalid UTF-8. The
+ * file is then parsed again with GMarkup, which reports any real error.
+ * What the scanner merged in before giving up is merged again with the
+ * same values, so the result doesn't change.
+ */
+
+typedef enum {
+	SCAN_OK,
+	SCAN_FAILED,		/* a callback set an error */
+	SCAN_UNSUPPORTED	/* leave the file to GMarkup */
+} ScanResult;
 
-gint
-mobile_provider_exit ()
+typedef struct {
+	const gchar *name;
+	gsize length;
+	ServiceXmlElement id;
+} ScanElement;
+
+typedef struct {
+	ServiceXmlParser *parser;
+	const gchar *p;
+	const gchar *end;
+
+	GString *key;		/* decoded value of the tag's key attribute */
+	GString *text;
+	GArray *open;		/* ScanElement, names point into the file */
+	gboolean root_seen;
+
+	/* Elements left open around this range and expected open after it */
+	guint base_depth;
+	guint open_at_end;
+} Scanner;
+
+static gboolean
+scan_is_space (gchar c)
 {
-	g_hash_table_destroy (country_codes);
-	g_hash_table_destroy (country_info);
-	g_hash_table_destroy (mcc_info);
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
 }
 
-/************ HELPER FUNCTIONS FOR MOBILE PROVIDER *********/
-
-GList *mobile_provider_get_country_list ()
+static const gchar *
+scan_skip_space (const gchar *p, const gchar *end)
 {
-	GList *country_list = NULL;
+	while (p < end && scan_is_space (*p))
+		p++;
 
-	country_list = g_hash_table_get_keys (country_codes);
-	if (country_list == NULL)
-		return NULL;
-
-	country_list = g_list_sort (country_list, (GCompareFunc) strcmp);
-
-	return country_list;
+	return p;
 }
 
-GList *mobile_provider_get_provider_list (const gchar *country_name)
+static const gchar *
+scan_find (const gchar *p, const gchar *end, const gchar *needle)
 {
-	GList *provider_list = NULL;
-	GHashTable *providers = NULL;
-	gchar *country_code = NULL;
+	gsize length = strlen (needle);
+
+	while (p < end && (p = memchr (p, needle[0], end - p)) != NULL) {
+		if ((gsize) (end - p) < length)
+			return NULL;
+		if (!memcmp (p, needle, length))
+			return p;
+		p++;
+	}
 
-	country_code = g_hash_table_lookup (country_codes, country_name);
+	return NULL;
+}
+
+static const gchar *
+scan_name_end (const gchar *p, const gchar *end)
+{
+	while (p < end && !scan_is_space (*p) &&
+	       *p != '>' && *p != '/' && *p != '=')
+		p++;
+
+	return p;
+}
+
+/* Append text with the predefined and numeric character entities expanded */
+static gboolean
+scan_decode (GString *out, const gchar *p, const gchar *end)
+{
+	const gchar *amp, *semi;
+
+	while ((amp = memchr (p, '&', end - p)) != NULL) {
+		gsize length;
+
+		g_string_append_len (out, p, amp - p);
+
+		semi = memchr (amp, ';', end - amp);
+		if (semi == NULL)
+			return FALSE;
+
+		amp++;
+		length = semi - amp;
+
+		if (length == 3 && !memcmp (amp, "amp", 3))
+			g_string_append_c (out, '&');
+		else if (length == 2 && !memcmp (amp, "lt", 2))
+			g_string_append_c (out, '<');
+		else if (length == 2 && !memcmp (amp, "gt", 2))
+			g_string_append_c (out, '>');
+		else if (length == 4 && !memcmp (amp, "quot", 4))
+			g_string_append_c (out, '"');
+		else if (length == 4 && !memcmp (amp, "apos", 4))
+			g_string_append_c (out, '\'');
+		else if (length > 1 && amp[0] == '#') {
+			gboolean hex = amp[1] == 'x';
+			gchar *digits_end;
+			gulong c;
+
+			if (!(hex ? g_ascii_isxdigit (amp[2]) : g_ascii_isdigit (amp[1])))
+				return FALSE;
+
+			c = strtoul (amp + (hex ? 2 : 1), &digits_end, hex ? 16 : 10);
+			if (digits_end != semi || c == 0 || !g_unichar_validate (c))
+				return FALSE;
+
+			g_string_append_unichar (out, c);
+		} else
+			return FALSE;
+
+		p = semi + 1;
+	}
+
+	g_string_append_len (out, p, end - p);
+
+	return TRUE;
+}
+
+/* Whether a comment, CDATA section or processing instruction starts in [p, end) */
+static gboolean
+scan_has_markup_declaration (const gchar *p, const gchar *end)
+{
+	while ((p = memchr (p, '<', end - p)) != NULL && ++p < end) {
+		if (*p == '!' || *p == '?')
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* Comments, processing instructions and the DOCTYPE mean nothing to us */
+static ScanResult
+scan_markup_declaration (Scanner *scanner)
+{
+	const gchar *p = scanner->p, *end = scanner->end, *close;
+
+	if (end - p >= 3 && !memcmp (p, "!--", 3)) {
+		close = scan_find (p + 3, end, "-->");
+		if (close == NULL)
+			return SCAN_UNSUPPORTED;
+		scanner->p = close + 3;
+	} else if (*p == '?') {
+		close = scan_find (p + 1, end, "?>");
+		if (close == NULL)
+			return SCAN_UNSUPPORTED;
+		scanner->p = close + 2;
+	} else if (end - p >= 8 && !memcmp (p, "!DOCTYPE", 8)) {
+		close = memchr (p, '>', end - p);
+		if (close == NULL || memchr (p, '[', close - p))
+			return SCAN_UNSUPPORTED;
+		scanner->p = close + 1;
+	} else
+		return SCAN_UNSUPPORTED;
+
+	return SCAN_OK;
+}
+
+static ScanResult
+scan_end_tag (Scanner *scanner)
+{
+	const gchar *p = scanner->p + 1, *name = p;
+	ScanElement *open;
+
+	p = scan_name_end (p, scanner->end);
+	if (p == name || scanner->open->len == 0)
+		return SCAN_UNSUPPORTED;
+
+	open = &g_array_index (scanner->open, ScanElement, scanner->open->len - 1);
+	if (open->length != (gsize) (p - name) || memcmp (open->name, name, p - name))
+		return SCAN_UNSUPPORTED;
+
+	p = scan_skip_space (p, scanner->end);
+	if (p == scanner->end || *p != '>')
+		return SCAN_UNSUPPORTED;
+
+	scanner->p = p + 1;
+	g_array_set_size (scanner->open, scanner->open->len - 1);
+
+	servicexml_end (scanner->parser, open->id);
+
+	return SCAN_OK;
+}
+
+static ScanResult
+scan_start_tag (Scanner *scanner, GError **error)
+{
+	const gchar *p = scanner->p, *end = scanner->end, *name = p, *close;
+	const gchar *key_name;
+	gsize key_length;
+	gboolean empty = FALSE, has_key = FALSE;
+	GError *local_error = NULL;
+	ScanElement element;
+
+	p = scan_name_end (p, end);
+	if (p == name ||
+	    (scanner->base_depth == 0 && scanner->open->len == 0 && scanner->root_seen))
+		return SCAN_UNSUPPORTED;
+
+	element.name = name;
+	element.length = p - name;
+	element.id = servicexml_element (name, element.length);
+
+	/* Only the key attribute is decoded, the others are just checked */
+	key_name = servicexml_key_attribute (element.id);
+	key_length = key_name ? strlen (key_name) : 0;
+
+	for (;;) {
+		const gchar *attribute;
+		gboolean is_key;
+		gchar quote;
+
+		p = scan_skip_space (p, end);
+		if (p == end)
+			return SCAN_UNSUPPORTED;
+
+		if (*p == '>') {
+			p++;
+			break;
+		}
+		if (*p == '/') {
+			if (p + 1 == end || p[1] != '>')
+				return SCAN_UNSUPPORTED;
+			empty = TRUE;
+			p += 2;
+			break;
+		}
+
+		/* GMarkup wants whitespace before each attribute */
+		if (!scan_is_space (p[-1]))
+			return SCAN_UNSUPPORTED;
+
+		attribute = p;
+		p = scan_name_end (p, end);
+		if (p == attribute)
+			return SCAN_UNSUPPORTED;
+
+		is_key = !has_key && (gsize) (p - attribute) == key_length &&
+			 !memcmp (attribute, key_name, key_length);
+
+		p = scan_skip_space (p, end);
+		if (p == end || *p != '=')
+			return SCAN_UNSUPPORTED;
+		p = scan_skip_space (p + 1, end);
+		if (p == end || (*p != '"' && *p != '\''))
+			return SCAN_UNSUPPORTED;
+
+		quote = *p++;
+		close = memchr (p, quote, end - p);
+		if (close == NULL || memchr (p, '<', close - p))
+			return SCAN_UNSUPPORTED;
+
+		if (is_key) {
+			g_string_truncate (scanner->key, 0);
+			if (!scan_decode (scanner->key, p, close))
+				return SCAN_UNSUPPORTED;
+			has_key = TRUE;
+		} else if (memchr (p, '&', close - p)) {
+			/* Entities GMarkup would reject must still send us there */
+			g_string_truncate (scanner->text, 0);
+			if (!scan_decode (scanner->text, p, close))
+				return SCAN_UNSUPPORTED;
+		}
+
+		p = close + 1;
+	}
+
+	scanner->p = p;
+	scanner->root_seen = TRUE;
+
+	servicexml_start (scanner->parser, element.id,
+			  has_key ? scanner->key->str : NULL, &local_error);
+	if (local_error) {
+		g_propagate_error (error, local_error);
+		return SCAN_FAILED;
+	}
+
+	if (empty) {
+		servicexml_end (scanner->parser, element.id);
+		return SCAN_OK;
+	}
+
+	/* Nothing in a cdma subtree is used, jump over it */
+	if (scanner->parser->state == PARSER_METHOD_CDMA) {
+		close = scan_find (p, end, "</cdma");
+		if (close == NULL)
+			return SCAN_UNSUPPORTED;
+
+		/*
+		 * The end tag found might be inside a comment or CDATA, and
+		 * the real one further on. Leave those subtrees to GMarkup.
+		 */
+		if (scan_has_markup_declaration (p, close))
+			return SCAN_UNSUPPORTED;
+
+		p = scan_skip_space (close + 6, end);
+		if (p == end || *p != '>')
+			return SCAN_UNSUPPORTED;
+
+		scanner->p = p + 1;
+		servicexml_end (scanner->parser, ELEMENT_CDMA);
+		return SCAN_OK;
+	}
+
+	g_array_append_val (scanner->open, element);
+
+	return SCAN_OK;
+}
+
+static ScanResult
+scan_text (Scanner *scanner, const gchar *text_end)
+{
+	const gchar *p = scanner->p;
+
+	/* Like GMarkup, no callback for empty text */
+	if (p == text_end)
+		return SCAN_OK;
+
+	if (scanner->open->len + scanner->base_depth == 0) {
+		if (scan_skip_space (p, text_end) != text_end)
+			return SCAN_UNSUPPORTED;
+		return SCAN_OK;
+	}
+
+	g_string_truncate (scanner->text, 0);
+	if (!scan_decode (scanner->text, p, text_end))
+		return SCAN_UNSUPPORTED;
+
+	servicexml_text (NULL, scanner->text->str, scanner->text->len, scanner->parser, NULL);
+
+	return SCAN_OK;
+}
+
+/*
+ * Scan [start, end). A whole document has base_depth and open_at_end 0,
+ * a run of countries cut out of one has base_depth 1 and open_at_end 0.
+ */
+static ScanResult
+servicexml_scan_range (ServiceXmlParser *parser,
+		       const gchar *start,
+		       const gchar *end,
+		       guint base_depth,
+		       guint open_at_end,
+		       GError **error)
+{
+	Scanner scanner;
+	ScanResult result = SCAN_OK;
+
+	scanner.parser = parser;
+	scanner.p = start;
+	scanner.end = end;
+	scanner.key = g_string_new (NULL);
+	scanner.text = g_string_new (NULL);
+	scanner.open = g_array_new (FALSE, FALSE, sizeof (ScanElement));
+	scanner.root_seen = FALSE;
+	scanner.base_depth = base_depth;
+	scanner.open_at_end = open_at_end;
+
+	while (result == SCAN_OK && scanner.p < scanner.end) {
+		const gchar *tag = memchr (scanner.p, '<', scanner.end - scanner.p);
+
+		result = scan_text (&scanner, tag ? tag : scanner.end);
+		if (result != SCAN_OK || tag == NULL)
+			break;
+
+		scanner.p = tag + 1;
+		if (scanner.p == scanner.end) {
+			result = SCAN_UNSUPPORTED;
+			break;
+		}
+
+		switch (*scanner.p) {
+		case '/':
+			result = scan_end_tag (&scanner);
+			break;
+		case '!':
+		case '?':
+			result = scan_markup_declaration (&scanner);
+			break;
+		default:
+			result = scan_start_tag (&scanner, error);
+			break;
+		}
+	}
+
+	if (result == SCAN_OK &&
+	    (scanner.open->len != scanner.open_at_end ||
+	     (scanner.base_depth == 0 && !scanner.root_seen)))
+		result = SCAN_UNSUPPORTED;
+
+	g_string_free (scanner.key, TRUE);
+	g_string_free (scanner.text, TRUE);
+	g_array_free (scanner.open, TRUE);
+
+	return result;
+}
+
+/***** parallel scan *******/
+
+/*
+ * Countries are independent, so big files are cut into runs of whole
+ * <country> elements that are scanned on a few threads, each into its
+ * own tables. The runs are then merged into the database in file
+ * order, so the result is the same as scanning the file front to back.
+ * Any run the scanner can't cope with sends the whole file back to
+ * the single-threaded path, the database is untouched until then.
+ */
+
+/* Below this, starting threads costs more than it saves */
+#define PARALLEL_SCAN_MIN_SIZE (256 * 1024)
+#define PARALLEL_SCAN_MAX_THREADS 4
+/* More runs than threads, so one slow run doesn't hold up the rest */
+#define PARALLEL_SCAN_RUNS_PER_THREAD 4
+
+typedef struct {
+	const gchar *start;
+	const gchar *end;
+	ServiceXmlParser parser;
+	ScanResult result;
+} ScanRun;
+
+/* Start of the next <country> tag at or after p */
+static const gchar *
+scan_find_country (const gchar *p, const gchar *end)
+{
+	while ((p = scan_find (p, end, "<country")) != NULL) {
+		if (p + 8 < end && (scan_is_space (p[8]) || p[8] == '>'))
+			return p;
+		p += 8;
+	}
+
+	return NULL;
+}
+
+/*
+ * Runs start right after the '>' before a country, so the text leading
+ * up to it is seen by the same run, just like in a front to back scan.
+ */
+static const gchar *
+scan_run_start (const gchar *country, const gchar *limit)
+{
+	const gchar *p = country;
+
+	while (p > limit && p[-1] != '>')
+		p--;
+
+	return p > limit ? p : NULL;
+}
+
+static void
+scan_run (gpointer data, gpointer user_data)
+{
+	ScanRun *run = data;
+
+	run->result = servicexml_scan_range (&run->parser, run->start, run->end, 1, 0, NULL);
+}
+
+static void
+scan_run_init (ScanRun *run, MobileProviderDatabase *db, const gchar *start, const gchar *end)
+{
+	servicexml_parser_init_private (&run->parser, db);
+
+	run->start = start;
+	run->end = end;
+	run->result = SCAN_UNSUPPORTED;
+}
+
+static ScanResult
+servicexml_scan_parallel (ServiceXmlParser *parser,
+			  const gchar *contents,
+			  gsize length,
+			  GError **error)
+{
+	const gchar *end = contents + length, *root_end, *first, *country, *tail;
+	GPtrArray *runs;
+	GThreadPool *pool;
+	ScanResult result;
+	guint n_threads, n_runs, i;
+	gsize run_size;
+
+	n_threads = MIN (g_get_num_processors (), PARALLEL_SCAN_MAX_THREADS);
+	if (n_threads < 2 || length < PARALLEL_SCAN_MIN_SIZE)
+		return SCAN_UNSUPPORTED;
+
+	/* Everything after the last country must close the root */
+	root_end = g_strrstr_len (contents, length, "</serviceproviders");
+	if (root_end == NULL)
+		return SCAN_UNSUPPORTED;
+	tail = scan_skip_space (root_end + 18, end);
+	if (tail == end || *tail != '>' || scan_skip_space (tail + 1, end) != end)
+		return SCAN_UNSUPPORTED;
+
+	country = scan_find_country (contents, root_end);
+	first = country ? scan_run_start (country, contents) : NULL;
+	if (first == NULL)
+		return SCAN_UNSUPPORTED;
+
+	/* The prologue and the root element, checks the format */
+	result = servicexml_scan_range (parser, contents, first, 0, 1, error);
+	if (result != SCAN_OK)
+		return result;
+
+	n_runs = n_threads * PARALLEL_SCAN_RUNS_PER_THREAD;
+	run_size = (root_end - first) / n_runs + 1;
+
+	runs = g_ptr_array_new ();
+	while (first) {
+		const gchar *next = NULL;
+		ScanRun *run = g_slice_new (ScanRun);
+
+		country = first + run_size < root_end ? scan_find_country (first + run_size, root_end) : NULL;
+		if (country)
+			next = scan_run_start (country, first);
+
+		scan_run_init (run, parser->db, first, next ? next : root_end);
+		g_ptr_array_add (runs, run);
+
+		first = next;
+	}
+
+	pool = g_thread_pool_new (scan_run, NULL, n_threads, TRUE, NULL);
+	if (pool) {
+		for (i = 0; i < runs->len; i++)
+			g_thread_pool_push (pool, g_ptr_array_index (runs, i), NULL);
+
+		/* Waits for every run */
+		g_thread_pool_free (pool, FALSE, TRUE);
+	}
+
+	for (i = 0; i < runs->len; i++) {
+		ScanRun *run = g_ptr_array_index (runs, i);
+
+		if (run->result != SCAN_OK)
+			result = SCAN_UNSUPPORTED;
+	}
+
+	for (i = 0; i < runs->len; i++) {
+		ScanRun *run = g_ptr_array_index (runs, i);
+
+		if (result == SCAN_OK)
+			servicexml_parser_merge (parser, &run->parser);
+
+		servicexml_parser_clear (&run->parser);
+		g_slice_free (ScanRun, run);
+	}
+	g_ptr_array_free (runs, TRUE);
+
+	return result;
+}
+
+static ScanResult
+servicexml_scan (ServiceXmlParser *parser, const gchar *contents, gsize length, GError **error)
+{
+	ScanResult result;
+
+	if (!g_utf8_validate (contents, length, NULL))
+		return SCAN_UNSUPPORTED;
+
+	result = servicexml_scan_parallel (parser, contents, length, error);
+	if (result != SCAN_UNSUPPORTED)
+		return result;
+
+	/* The prologue may have been scanned already, start over */
+	servicexml_parser_reset (parser);
+
+	return servicexml_scan_range (parser, contents, contents + length, 0, 0, error);
+}
+
+/***** end of scanner *******/
+
+/***** parse iso3166.xml *******/
+static void
+iso3166_start_element (GMarkupParseContext *context,
+                               const gchar *element_name,
+                               const gchar **attribute_names,
+                               const gchar **attribute_values,
+                               gpointer data,
+                               GError **error)
+{
+	MobileProviderDatabase *db = data;
+	int i;
+	const char *country_code = NULL;
+	const char *common_name = NULL;
+	const char *name = NULL;
+
+	if (!strcmp (element_name, "iso_3166_entry")) {
+		for (i = 0; attribute_names && attribute_names[i]; i++) {
+			if (!strcmp (attribute_names[i], "alpha_2_code"))
+				country_code = attribute_values[i];
+			else if (!strcmp (attribute_names[i], "common_name"))
+				common_name = attribute_values[i];
+			else if (!strcmp (attribute_names[i], "name"))
+				name = attribute_values[i];
+		}
+		if (!country_code) {
+			g_warning ("%s: missing mandatory 'alpha_2_code' atribute in '%s'"
+			           " element.", __func__, element_name);
+			return;
+		}
+		if (!name) {
+			g_warning ("%s: missing mandatory 'name' atribute in '%s'"
+			           " element.", __func__, element_name);
+			return;
+		}
+
+		/* Nobody will ever ask for a country without providers */
+		if (!g_hash_table_contains (db->country_info, country_code))
+			return;
+
+		g_hash_table_insert (db->iso_names, g_strdup (country_code),
+				     g_strdup (common_name ? common_name : name));
+	}
+}
+
+static GMarkupParser iso3166parser = {
+	iso3166_start_element,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
+
+/***end of parser***/
+
+static gboolean
+mobile_provider_parse_contents (const GMarkupParser *markup_parser,
+				gpointer user_data,
+				const gchar *contents,
+				gsize length,
+				GError **error)
+{
+	GMarkupParseContext *context;
+	gboolean ret;
+
+	context = g_markup_parse_context_new (markup_parser, 0, user_data, NULL);
+
+	ret = g_markup_parse_context_parse (context, contents, length, error) &&
+	      g_markup_parse_context_end_parse (context, error);
+
+	g_markup_parse_context_free (context);
+
+	return ret;
+}
+
+static gboolean
+is_compressed (const gchar *filename)
+{
+	return g_str_has_suffix (filename, ".gz") || g_str_has_suffix (filename, ".xz");
+}
+
+static gboolean
+parse_stream (GMarkupParseContext *context,
+	      GInputStream *stream,
+	      gchar *buffer,
+	      GError **error)
+{
+	gssize n;
+
+	while ((n = g_input_stream_read (stream, buffer, PARSE_CHUNK_SIZE, NULL, error)) > 0) {
+		if (!g_markup_parse_context_parse (context, buffer, n, error))
+			return FALSE;
+	}
+
+	return n == 0 && g_markup_parse_context_end_parse (context, error);
+}
+
+#ifdef HAVE_LZMA
+/* GIO has no xz GConverter, run liblzma by hand */
+static gboolean
+parse_xz_stream (GMarkupParseContext *context,
+		 GInputStream *stream,
+		 gchar *buffer,
+		 GError **error)
+{
+	lzma_stream xz = LZMA_STREAM_INIT;
+	lzma_action action = LZMA_RUN;
+	lzma_ret ret;
+	guint8 *in;
+	gboolean success = FALSE;
+
+	if (lzma_stream_decoder (&xz, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK) {
+		g_set_error (error, MOBILE_PROVIDER_ERROR, MOBILE_PROVIDER_ERROR_PARSE,
+			     "Unable to start the xz decoder");
+		return FALSE;
+	}
+
+	in = g_malloc (PARSE_CHUNK_SIZE);
+
+	xz.next_out = (guint8 *) buffer;
+	xz.avail_out = PARSE_CHUNK_SIZE;
+
+	do {
+		if (xz.avail_in == 0 && action == LZMA_RUN) {
+			gssize n = g_input_stream_read (stream, in, PARSE_CHUNK_SIZE, NULL, error);
+
+			if (n < 0)
+				goto out;
+
+			xz.next_in = in;
+			xz.avail_in = n;
+			if (n == 0)
+				action = LZMA_FINISH;
+		}
+
+		ret = lzma_code (&xz, action);
+
+		if (xz.avail_out == 0 || ret == LZMA_STREAM_END) {
+			if (!g_markup_parse_context_parse (context, buffer,
+							   PARSE_CHUNK_SIZE - xz.avail_out, error))
+				goto out;
+
+			xz.next_out = (guint8 *) buffer;
+			xz.avail_out = PARSE_CHUNK_SIZE;
+		}
+	} while (ret == LZMA_OK);
+
+	if (ret != LZMA_STREAM_END) {
+		g_set_error (error, MOBILE_PROVIDER_ERROR, MOBILE_PROVIDER_ERROR_PARSE,
+			     "Corrupt xz data (error %d)", ret);
+		goto out;
+	}
+
+	success = g_markup_parse_context_end_parse (context, error);
+out:
+	lzma_end (&xz);
+	g_free (in);
+
+	return success;
+}
+#endif
+
+/*
+ * Some images ship the database compressed. It is decompressed a chunk
+ * at a time straight into GMarkup, so neither the compressed nor the
+ * plain file is ever fully in memory. The fast scanner needs the whole
+ * file, so these always take the GMarkup path; the merged cache keeps
+ * that to the first start after an update.
+ */
+static gboolean
+mobile_provider_parse_compressed (MobileProviderDatabase *db,
+				  const gchar *filename,
+				  const GMarkupParser *markup_parser,
+				  gpointer user_data,
+				  GError **error)
+{
+	GMarkupParseContext *context;
+	GInputStream *stream;
+	GFile *file;
+	gchar *buffer;
+	gboolean ret;
+
+#ifndef HAVE_LZMA
+	if (g_str_has_suffix (filename, ".xz")) {
+		g_set_error (error, MOBILE_PROVIDER_ERROR, MOBILE_PROVIDER_ERROR_FORMAT,
+			     "Built without xz support");
+		return FALSE;
+	}
+#endif
+
+	file = g_file_new_for_path (filename);
+	stream = G_INPUT_STREAM (g_file_read (file, NULL, error));
+	g_object_unref (file);
+	if (stream == NULL)
+		return FALSE;
+
+	if (g_str_has_suffix (filename, ".gz")) {
+		GConverter *decompressor;
+		GInputStream *plain;
+
+		decompressor = G_CONVERTER (g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP));
+		plain = g_converter_input_stream_new (stream, decompressor);
+		g_object_unref (decompressor);
+		g_object_unref (stream);
+		stream = plain;
+	}
+
+	/* Decoder state aside, the two chunk buffers are all we hold */
+	input_usage_add (db, 2 * PARSE_CHUNK_SIZE);
+
+	buffer = g_malloc (PARSE_CHUNK_SIZE);
+	context = g_markup_parse_context_new (markup_parser, 0, user_data, NULL);
+
+#ifdef HAVE_LZMA
+	if (g_str_has_suffix (filename, ".xz"))
+		ret = parse_xz_stream (context, stream, buffer, error);
+	else
+#endif
+		ret = parse_stream (context, stream, buffer, error);
+
+	g_markup_parse_context_free (context);
+	g_free (buffer);
+	g_object_unref (stream);
+
+	input_usage_remove (db, 2 * PARSE_CHUNK_SIZE);
+
+	return ret;
+}
+
+static gboolean
+mobile_provider_parse_file (MobileProviderDatabase *db,
+			    const gchar *filename,
+			    const GMarkupParser *markup_parser,
+			    gpointer user_data,
+			    GError **error)
+{
+	gchar *contents;
+	gsize length;
+	gboolean ret;
+
+	if (is_compressed (filename))
+		return mobile_provider_parse_compressed (db, filename, markup_parser,
+							 user_data, error);
+
+	if (!g_file_get_contents (filename, &contents, &length, error))
+		return FALSE;
+
+	input_usage_add (db, length + 1);
+
+	ret = mobile_provider_parse_contents (markup_parser, user_data, contents, length, error);
+
+	g_free (contents);
+
+	input_usage_remove (db, length + 1);
+
+	return ret;
+}
+
+/* Scan the file, and leave it to GMarkup if the scanner can't cope */
+static gboolean
+mobile_provider_parse_service_file (MobileProviderDatabase *db,
+				    const gchar *filename,
+				    ServiceXmlParser *parser,
+				    GError **error)
+{
+	gchar *contents;
+	gsize length;
+	ScanResult result = SCAN_UNSUPPORTED;
+	gboolean ret;
+
+	if (is_compressed (filename))
+		return mobile_provider_parse_compressed (db, filename, &servicexmlparser,
+							 parser, error);
+
+	if (!g_file_get_contents (filename, &contents, &length, error))
+		return FALSE;
+
+	input_usage_add (db, length + 1);
+
+	if (g_strcmp0 (g_getenv (SERVICE_XML_PARSER_ENV), "gmarkup"))
+		result = servicexml_scan (parser, contents, length, error);
+
+	if (result == SCAN_UNSUPPORTED) {
+		servicexml_parser_reset (parser);
+
+		ret = mobile_provider_parse_contents (&servicexmlparser, parser,
+						      contents, length, error);
+	} else
+		ret = result == SCAN_OK;
+
+	g_free (contents);
+
+	input_usage_remove (db, length + 1);
+
+	return ret;
+}
+
+typedef struct {
+	GByteArray *pool;
+	GHashTable *offsets;		/* String (key) <--> offset (value), borrowed */
+} PoolBuilder;
+
+/* Repeated strings, like empty passwords, are stored once */
+static guint32
+pool_add (PoolBuilder *builder, const gchar *str)
+{
+	gpointer offset;
+
+	if (str == NULL)
+		return POOL_NONE;
+
+	if (g_hash_table_lookup_extended (builder->offsets, str, NULL, &offset))
+		return GPOINTER_TO_UINT (offset);
+
+	offset = GUINT_TO_POINTER (builder->pool->len);
+	g_byte_array_append (builder->pool, (const guint8 *) str, strlen (str) + 1);
+	g_hash_table_insert (builder->offsets, (gpointer) str, offset);
+
+	return GPOINTER_TO_UINT (offset);
+}
+
+static const gchar *
+pool_string (MobileProviderDatabase *db, guint32 offset)
+{
+	return offset == POOL_NONE ? NULL : db->pool + offset;
+}
+
+static void
+provider_pack_plans (Provider *provider, PoolBuilder *builder)
+{
+	guint i;
+
+	g_free (provider->plan_names);
+	provider->plan_names = sorted_keys (provider->plans);
+	provider->n_records = g_hash_table_size (provider->plans);
+	provider->records = g_new (PlanRecord, provider->n_records);
+
+	for (i = 0; i < provider->n_records; i++) {
+		const PlanInfo *info = g_hash_table_lookup (provider->plans,
+							    provider->plan_names[i]);
+		PlanRecord *record = &provider->records[i];
+
+		record->name = pool_add (builder, provider->plan_names[i]);
+		record->apn = pool_add (builder, info->apn);
+		record->username = pool_add (builder, info->username);
+		record->password = pool_add (builder, info->password);
+	}
+}
+
+/* The pool is final now, drop the heap copies */
+static void
+provider_pack_finish (MobileProviderDatabase *db, Provider *provider)
+{
+	guint i;
+
+	for (i = 0; i < provider->n_records; i++)
+		provider->plan_names[i] = pool_string (db, provider->records[i].name);
+
+	g_hash_table_destroy (provider->plans);
+	provider->plans = NULL;
+}
+
+/*
+ * Once loaded, plans are fixed-size records of 32-bit offsets into one
+ * string pool rather than a hash table of heap strings per provider.
+ * Done in two passes, the pool moves while it grows.
+ */
+static void
+mobile_provider_database_pack_plans (MobileProviderDatabase *db)
+{
+	GHashTableIter country_iter, provider_iter;
+	PoolBuilder builder;
+	gpointer value;
+
+	if (db->pool)
+		return;
+
+	builder.pool = g_byte_array_new ();
+	builder.offsets = g_hash_table_new (g_str_hash, g_str_equal);
+
+	g_hash_table_iter_init (&country_iter, db->country_info);
+	while (g_hash_table_iter_next (&country_iter, NULL, &value)) {
+		g_hash_table_iter_init (&provider_iter, ((Country *) value)->providers);
+		while (g_hash_table_iter_next (&provider_iter, NULL, &value))
+			provider_pack_plans (value, &builder);
+	}
+
+	g_hash_table_destroy (builder.offsets);
+
+	if (builder.pool->len >= POOL_NONE)
+		g_error ("Provider database strings don't fit in 32-bit offsets");
+
+	db->pool_size = builder.pool->len;
+	db->pool = (gchar *) g_byte_array_free (builder.pool, FALSE);
+
+	g_hash_table_iter_init (&country_iter, db->country_info);
+	while (g_hash_table_iter_next (&country_iter, NULL, &value)) {
+		g_hash_table_iter_init (&provider_iter, ((Country *) value)->providers);
+		while (g_hash_table_iter_next (&provider_iter, NULL, &value))
+			provider_pack_finish (db, value);
+	}
+}
+
+/* Build the sorted name lists handed out by the getters */
+static void
+mobile_provider_database_index (MobileProviderDatabase *db)
+{
+	GHashTableIter country_iter;
+	gpointer value;
+
+	g_hash_table_iter_init (&country_iter, db->country_info);
+	while (g_hash_table_iter_next (&country_iter, NULL, &value)) {
+		Country *country = value;
+
+		g_free (country->provider_names);
+		country->provider_names = sorted_keys (country->providers);
+	}
+
+	mobile_provider_database_pack_plans (db);
+}
+
+/* Numeric value of a three digit MCC, -1 if it isn't one */
+static gint
+mcc_index (const gchar *mcc)
+{
+	if (!g_ascii_isdigit (mcc[0]) || !g_ascii_isdigit (mcc[1]) ||
+	    !g_ascii_isdigit (mcc[2]) || mcc[3] != '\0')
+		return -1;
+
+	return (mcc[0] - '0') * 100 + (mcc[1] - '0') * 10 + (mcc[2] - '0');
+}
+
+static void
+mobile_provider_database_index_mccs (MobileProviderDatabase *db)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	gint index;
+
+	db->mcc_table = g_new0 (MccCountry, MCC_TABLE_SIZE);
+
+	g_hash_table_iter_init (&iter, db->mcc_info);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		index = mcc_index (key);
+		if (index < 0) {
+			g_warning ("Ignoring malformed MCC '%s'", (gchar *) key);
+			continue;
+		}
+
+		db->mcc_table[index].code = value;
+	}
+}
+
+/***** merged database cache *******/
+
+/*
+ * Parsing every layer on each start would make overlays cost per-launch
+ * time, so the merged providers and MCCs are kept in a GVariant file
+ * that is mapped on the next start. It is reused only while every input
+ * file has the same mtime and size it had when the cache was written.
+ * The mtime includes nanoseconds, an overlay rewritten within the same
+ * second to the same size still invalidates the cache.
+ */
+static GVariant *
+mobile_provider_cache_stamp (gchar **files)
+{
+	GVariantBuilder builder;
+	GStatBuf st;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sxxt)"));
+
+	for (; files && *files; files++) {
+		if (g_stat (*files, &st) < 0) {
+			g_variant_builder_clear (&builder);
+			return NULL;
+		}
+
+		g_variant_builder_add (&builder, "(sxxt)", *files,
+				       (gint64) st.st_mtime, (gint64) st.st_mtim.tv_nsec,
+				       (guint64) st.st_size);
+	}
+
+	return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static gchar *
+mobile_provider_cache_path (gchar **files)
+{
+	gchar *joined, *checksum, *name, *path;
+
+	/* One cache per list of layers */
+	joined = g_strjoinv ("\n", files);
+	checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, joined, -1);
+	name = g_strdup_printf ("providers-%s.cache", checksum);
+
+	path = g_build_filename (g_get_user_cache_dir (), "ofono-wizard", name, NULL);
+
+	g_free (name);
+	g_free (checksum);
+	g_free (joined);
+
+	return path;
+}
+
+static GVariant *
+mobile_provider_cache_open (const gchar *path, GVariant *stamp)
+{
+	GMappedFile *mapped;
+	GVariant *cache, *cached_stamp;
+	gboolean valid;
+
+	mapped = g_mapped_file_new (path, FALSE, NULL);
+	if (mapped == NULL)
+		return NULL;
+
+	if (g_mapped_file_get_length (mapped) == 0) {
+		g_mapped_file_unref (mapped);
+		return NULL;
+	}
+
+	cache = g_variant_new_from_data (G_VARIANT_TYPE (PROVIDER_CACHE_TYPE),
+					 g_mapped_file_get_contents (mapped),
+					 g_mapped_file_get_length (mapped),
+					 FALSE,
+					 (GDestroyNotify) g_mapped_file_unref,
+					 mapped);
+	g_variant_ref_sink (cache);
+
+	cached_stamp = g_variant_get_child_value (cache, 1);
+	valid = g_variant_equal (cached_stamp, stamp);
+	g_variant_unref (cached_stamp);
+
+	if (!valid) {
+		g_variant_unref (cache);
+		return NULL;
+	}
+
+	{
+		GVariant *version = g_variant_get_child_value (cache, 0);
+
+		valid = g_variant_get_uint32 (version) == PROVIDER_CACHE_VERSION;
+		g_variant_unref (version);
+	}
+
+	if (!valid) {
+		g_variant_unref (cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+static void
+mobile_provider_cache_load (MobileProviderDatabase *db, GVariant *cache)
+{
+	GVariant *mccs, *countries, *providers, *plans, *mms, *mms_value;
+	GVariantIter mcc_iter, country_iter, provider_iter, plan_iter;
+	gchar *mcc, *code, *provider_name, *plan_name;
+	gchar *apn, *username, *password, *mmsc, *mmsproxy;
+
+	mccs = g_variant_get_child_value (cache, 2);
+	g_variant_iter_init (&mcc_iter, mccs);
+	while (g_variant_iter_next (&mcc_iter, "{ss}", &mcc, &code))
+		g_hash_table_replace (db->mcc_info, mcc, code);
+	g_variant_unref (mccs);
+
+	countries = g_variant_get_child_value (cache, 3);
+	g_variant_iter_init (&country_iter, countries);
+	while (g_variant_iter_next (&country_iter, "(s@a(sa(smsmsms)m(smsmsmsms)))", &code, &providers)) {
+		Country *country = g_slice_new0 (Country);
+
+		country->providers = g_hash_table_new_full (g_str_hash, g_str_equal,
+							    (GDestroyNotify) g_free,
+							    (GDestroyNotify) provider_free);
+
+		g_variant_iter_init (&provider_iter, providers);
+		while (g_variant_iter_next (&provider_iter, "(s@a(smsmsms)@m(smsmsmsms))",
+					    &provider_name, &plans, &mms)) {
+			Provider *provider = g_slice_new0 (Provider);
+
+			provider->plans = g_hash_table_new_full (g_str_hash, g_str_equal,
+								 (GDestroyNotify) g_free,
+								 (GDestroyNotify) servicexml_plan_info_free);
+
+			g_variant_iter_init (&plan_iter, plans);
+			while (g_variant_iter_next (&plan_iter, "(smsmsms)",
+						    &plan_name, &apn, &username, &password)) {
+				PlanInfo *info = g_slice_new0 (PlanInfo);
+
+				info->apn = apn;
+				info->username = username;
+				info->password = password;
+
+				g_hash_table_insert (provider->plans, plan_name, info);
+			}
+			g_variant_unref (plans);
+
+			mms_value = g_variant_get_maybe (mms);
+			if (mms_value) {
+				g_variant_get (mms_value, "(smsmsmsms)",
+					       &apn, &username, &password, &mmsc, &mmsproxy);
+
+				provider->mms = g_slice_new0 (PlanInfo);
+				provider->mms->apn = apn;
+				provider->mms->username = username;
+				provider->mms->password = password;
+				provider->mms->mmsc = mmsc;
+				provider->mms->mmsproxy = mmsproxy;
+
+				g_variant_unref (mms_value);
+			}
+			g_variant_unref (mms);
+
+			g_hash_table_insert (country->providers, provider_name, provider);
+		}
+		g_variant_unref (providers);
+
+		g_hash_table_replace (db->country_info, code, country);
+	}
+	g_variant_unref (countries);
+}
+
+static void
+mobile_provider_cache_save (MobileProviderDatabase *db, const gchar *path, GVariant *stamp)
+{
+	GVariantBuilder mccs, countries, providers, plans;
+	GHashTableIter country_iter, provider_iter, plan_iter, mcc_iter;
+	gpointer key, value;
+	GVariant *cache;
+	GError *error = NULL;
+	gchar *dir;
+
+	g_variant_builder_init (&mccs, G_VARIANT_TYPE ("a{ss}"));
+	g_hash_table_iter_init (&mcc_iter, db->mcc_info);
+	while (g_hash_table_iter_next (&mcc_iter, &key, &value))
+		g_variant_builder_add (&mccs, "{ss}", key, value);
+
+	g_variant_builder_init (&countries, G_VARIANT_TYPE ("a(sa(sa(smsmsms)m(smsmsmsms)))"));
+	g_hash_table_iter_init (&country_iter, db->country_info);
+	while (g_hash_table_iter_next (&country_iter, &key, &value)) {
+		const gchar *code = key;
+		Country *country = value;
+
+		g_variant_builder_init (&providers, G_VARIANT_TYPE ("a(sa(smsmsms)m(smsmsmsms))"));
+		g_hash_table_iter_init (&provider_iter, country->providers);
+		while (g_hash_table_iter_next (&provider_iter, &key, &value)) {
+			const gchar *provider_name = key;
+			Provider *provider = value;
+			GVariant *mms = NULL;
+
+			g_variant_builder_init (&plans, G_VARIANT_TYPE ("a(smsmsms)"));
+			g_hash_table_iter_init (&plan_iter, provider->plans);
+			while (g_hash_table_iter_next (&plan_iter, &key, &value)) {
+				PlanInfo *info = value;
+
+				g_variant_builder_add (&plans, "(smsmsms)", key,
+						       info->apn, info->username, info->password);
+			}
+
+			if (provider->mms)
+				mms = g_variant_new ("(smsmsmsms)", provider->mms->apn,
+						     provider->mms->username, provider->mms->password,
+						     provider->mms->mmsc, provider->mms->mmsproxy);
+
+			g_variant_builder_add (&providers, "(s@a(smsmsms)@m(smsmsmsms))", provider_name,
+					       g_variant_builder_end (&plans),
+					       g_variant_new_maybe (G_VARIANT_TYPE ("(smsmsmsms)"), mms));
+		}
+
+		g_variant_builder_add (&countries, "(s@a(sa(smsmsms)m(smsmsmsms)))", code,
+				       g_variant_builder_end (&providers));
+	}
+
+	cache = g_variant_new ("(u@a(sxxt)@a{ss}@a(sa(sa(smsmsms)m(smsmsmsms))))",
+			       PROVIDER_CACHE_VERSION, stamp,
+			       g_variant_builder_end (&mccs),
+			       g_variant_builder_end (&countries));
+	g_variant_ref_sink (cache);
+
+	/* Serialised on first use, the builders are gone by then */
+	input_usage_add (db, g_variant_get_size (cache));
+
+	dir = g_path_get_dirname (path);
+	g_mkdir_with_parents (dir, 0755);
+	g_free (dir);
+
+	/* Not being able to cache only costs time on the next start */
+	if (!g_file_set_contents (path, g_variant_get_data (cache),
+				  g_variant_get_size (cache), &error)) {
+		g_debug ("Unable to write provider cache: %s", error->message);
+		g_error_free (error);
+	}
+
+	input_usage_remove (db, g_variant_get_size (cache));
+	g_variant_unref (cache);
+}
+
+/***** end of merged database cache *******/
+
+static gboolean
+mobile_provider_database_parse_files (MobileProviderDatabase *db, GError **error)
+{
+	gchar **file;
+
+	for (file = db->files; *file; file++) {
+		ServiceXmlParser parser, overlay;
+		GError *local_error = NULL;
+		gboolean ret;
+
+		servicexml_parser_init (&parser, db);
+
+		/*
+		 * Overlays are parsed into tables of their own and merged only
+		 * if they parse, a broken one must not take the database down
+		 * with it or leave half its countries behind.
+		 */
+		if (file == db->files)
+			ret = mobile_provider_parse_service_file (db, *file, &parser, &local_error);
+		else {
+			servicexml_parser_init_private (&overlay, db);
+
+			ret = mobile_provider_parse_service_file (db, *file, &overlay, &local_error);
+			if (ret)
+				servicexml_parser_merge (&parser, &overlay);
+
+			servicexml_parser_clear (&overlay);
+		}
+
+		servicexml_parser_clear (&parser);
+
+		if (ret)
+			continue;
+
+		if (file == db->files) {
+			g_propagate_prefixed_error (error, local_error, "%s: ", *file);
+			return FALSE;
+		}
+
+		g_warning ("Ignoring provider overlay %s: %s", *file, local_error->message);
+		g_error_free (local_error);
+	}
+
+	return TRUE;
+}
+
+static gboolean
+mobile_provider_database_load_providers (MobileProviderDatabase *db, GError **error)
+{
+	GVariant *stamp = NULL, *cache = NULL;
+	gchar *cache_path = NULL;
+
+	if (!(db->flags & MOBILE_PROVIDER_DATABASE_FLAGS_NO_CACHE)) {
+		stamp = mobile_provider_cache_stamp (db->files);
+		cache_path = mobile_provider_cache_path (db->files);
+	}
+
+	if (stamp)
+		cache = mobile_provider_cache_open (cache_path, stamp);
+
+	if (cache) {
+		gsize size = g_variant_get_size (cache);
+
+		input_usage_add (db, size);
+		mobile_provider_cache_load (db, cache);
+		g_variant_unref (cache);
+		input_usage_remove (db, size);
+	} else {
+		if (!mobile_provider_database_parse_files (db, error)) {
+			if (stamp)
+				g_variant_unref (stamp);
+			g_free (cache_path);
+			return FALSE;
+		}
+
+		if (stamp)
+			mobile_provider_cache_save (db, cache_path, stamp);
+	}
+
+	if (stamp)
+		g_variant_unref (stamp);
+	g_free (cache_path);
+
+	mobile_provider_database_index (db);
+
+	return TRUE;
+}
+
+static gboolean
+mobile_provider_database_load (MobileProviderDatabase *db, GError **error)
+{
+	const gchar *iso_codes;
+
+	if (!mobile_provider_database_load_providers (db, error))
+		return FALSE;
+
+	iso_codes = g_getenv (ISO_3166_COUNTRY_CODES_ENV);
+	if (iso_codes == NULL)
+		iso_codes = ISO_3166_COUNTRY_CODES;
+
+	/* parse iso3166 for the country names */
+	if (!mobile_provider_parse_file (db, iso_codes, &iso3166parser, db, error))
+		return FALSE;
+
+	mobile_provider_database_index_mccs (db);
+
+	return TRUE;
+}
+
+/***** provider database service *******/
+
+static gboolean
+mobile_provider_service_connect (MobileProviderDatabase *db)
+{
+	GError *error = NULL;
+	GVariant *countries;
+	GVariantIter iter;
+	const gchar *code, *name;
+	gchar *owner;
+
+	db->service = provider_database_proxy_new_for_bus_sync (G_BUS_TYPE_SYSTEM,
+								G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES |
+								G_DBUS_PROXY_FLAGS_DO_NOT_CONNECT_SIGNALS |
+								G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START,
+								PROVIDER_DATABASE_SERVICE,
+								PROVIDER_DATABASE_PATH,
+								NULL,
+								&error);
+	if (db->service == NULL) {
+		g_error_free (error);
+		return FALSE;
+	}
+
+	/* The service is optional, don't wait for a timeout if it's not there */
+	owner = g_dbus_proxy_get_name_owner (G_DBUS_PROXY (db->service));
+	if (owner == NULL) {
+		g_clear_object (&db->service);
+		return FALSE;
+	}
+	g_free (owner);
+
+	if (!provider_database_call_get_countries_sync (db->service, &countries, NULL, &error)) {
+		g_warning ("Unable to get countries from the provider database service: %s", error->message);
+		g_error_free (error);
+		g_clear_object (&db->service);
+		return FALSE;
+	}
+
+	/* Names come untranslated, the service doesn't know our locale */
+	g_variant_iter_init (&iter, countries);
+	while (g_variant_iter_next (&iter, "(&s&s)", &code, &name))
+		g_hash_table_insert (db->iso_names, g_strdup (code), g_strdup (name));
+	g_variant_unref (countries);
+
+	db->remote_providers = g_hash_table_new_full (g_str_hash, g_str_equal,
+						      (GDestroyNotify) g_free,
+						      (GDestroyNotify) g_strfreev);
+	db->remote_plans = g_hash_table_new_full (g_str_hash, g_str_equal,
+						  (GDestroyNotify) g_free,
+						  (GDestroyNotify) g_strfreev);
+	db->remote_plan_info = g_hash_table_new_full (g_str_hash, g_str_equal,
+						      (GDestroyNotify) g_free,
+						      (GDestroyNotify) servicexml_plan_info_free);
+	db->remote_mms_info = g_hash_table_new_full (g_str_hash, g_str_equal,
+						     (GDestroyNotify) g_free,
+						     (GDestroyNotify) remote_plan_info_free);
+
+	return TRUE;
+}
+
+/*
+ * The service went away, carry on with our own copy of the database.
+ * It is loaded as a separate database and only then published in
+ * local, so threads reading this one never see its tables change.
+ * The cached replies are kept until the database is freed, callers may
+ * still hold them. Called with the lock held, calls that were in flight
+ * when the service went away all end up here and only the first counts.
+ */
+static void
+mobile_provider_service_failed (MobileProviderDatabase *db, GError *error)
+{
+	GError *load_error = NULL;
+
+	if (db->service == NULL) {
+		g_error_free (error);
+		return;
+	}
+
+	g_warning ("Provider database service failed: %s", error->message);
+	g_error_free (error);
+
+	g_clear_object (&db->service);
+
+	db->local = mobile_provider_database_new_for_files ((const gchar * const *) db->files,
+							    db->flags & ~MOBILE_PROVIDER_DATABASE_FLAGS_USE_SERVICE,
+							    &load_error);
+	if (db->local == NULL) {
+		g_warning ("Unable to load the mobile provider database: %s", load_error->message);
+		g_error_free (load_error);
+	}
+}
+
+/* D-Bus has no NULL strings, empty means not set */
+static gchar *
+empty_to_null (gchar *str)
+{
+	if (str && *str == '\0') {
+		g_free (str);
+		return NULL;
+	}
+
+	return str;
+}
+
+/*
+ * The lock is dropped while a call is in flight, so another thread may
+ * have kept a reply for the same key meanwhile. Callers may already
+ * hold that one, it stays and the new one is freed.
+ */
+static gpointer
+mobile_provider_service_keep (GHashTable *table, gchar *key, gpointer value,
+			      GDestroyNotify value_free)
+{
+	gpointer kept;
+
+	if (g_hash_table_lookup_extended (table, key, NULL, &kept)) {
+		g_free (key);
+		if (value)
+			value_free (value);
+		return kept;
+	}
+
+	g_hash_table_insert (table, key, value);
+
+	return value;
+}
+
+static const gchar * const *
+mobile_provider_service_get_providers (MobileProviderDatabase *db, const gchar *country_code)
+{
+	ProviderDatabase *service;
+	GError *error = NULL;
+	gchar **providers;
+	gboolean ret;
+
+	providers = g_hash_table_lookup (db->remote_providers, country_code);
+	if (providers)
+		return (const gchar * const *) providers;
+
+	/* Other threads' lookups shouldn't wait for this round trip */
+	service = g_object_ref (db->service);
+	g_mutex_unlock (&db->lock);
+
+	ret = provider_database_call_get_providers_sync (service, country_code,
+							 &providers, NULL, &error);
+	/* The service has no locale, put them in ours */
+	if (ret)
+		sort_names ((const gchar **) providers, g_strv_length (providers));
+
+	g_mutex_lock (&db->lock);
+	g_object_unref (service);
+
+	if (!ret) {
+		mobile_provider_service_failed (db, error);
+		return NULL;
+	}
+
+	return mobile_provider_service_keep (db->remote_providers, g_strdup (country_code),
+					     providers, (GDestroyNotify) g_strfreev);
+}
+
+static const gchar * const *
+mobile_provider_service_get_plans (MobileProviderDatabase *db,
+				   const gchar *country_code,
+				   const gchar *provider_name)
+{
+	ProviderDatabase *service;
+	GError *error = NULL;
+	gchar **plans;
+	gchar *key;
+	gboolean ret;
+
+	key = g_strjoin ("/", country_code, provider_name, NULL);
+
+	plans = g_hash_table_lookup (db->remote_plans, key);
+	if (plans) {
+		g_free (key);
+		return (const gchar * const *) plans;
+	}
+
+	service = g_object_ref (db->service);
+	g_mutex_unlock (&db->lock);
+
+	ret = provider_database_call_get_plans_sync (service, country_code, provider_name,
+						     &plans, NULL, &error);
+	if (ret)
+		sort_names ((const gchar **) plans, g_strv_length (plans));
+
+	g_mutex_lock (&db->lock);
+	g_object_unref (service);
+
+	if (!ret) {
+		g_free (key);
+		mobile_provider_service_failed (db, error);
+		return NULL;
+	}
+
+	return mobile_provider_service_keep (db->remote_plans, key,
+					     plans, (GDestroyNotify) g_strfreev);
+}
+
+/*
+ * The service answers lookups that find nothing with its own NotFound
+ * error. Anything else, including the bus telling us the service is
+ * gone, means it failed and we parse the files ourselves.
+ */
+static gboolean
+mobile_provider_service_not_found (GError *error)
+{
+	gchar *remote;
+	gboolean not_found;
+
+	remote = g_dbus_error_get_remote_error (error);
+	not_found = !g_strcmp0 (remote, PROVIDER_DATABASE_SERVICE ".Error.NotFound");
+	g_free (remote);
+
+	return not_found;
+}
+
+static const PlanInfo *
+mobile_provider_service_get_plan_info (MobileProviderDatabase *db,
+				       const gchar *country_code,
+				       const gchar *provider_name,
+				       const gchar *plan_name)
+{
+	ProviderDatabase *service;
+	GError *error = NULL;
+	PlanInfo *info;
+	gchar *key, *apn, *username, *password;
+	gboolean ret;
+
+	key = g_strjoin ("/", country_code, provider_name, plan_name, NULL);
+
+	info = g_hash_table_lookup (db->remote_plan_info, key);
+	if (info) {
+		g_free (key);
+		return info;
+	}
+
+	service = g_object_ref (db->service);
+	g_mutex_unlock (&db->lock);
+
+	ret = provider_database_call_get_plan_info_sync (service, country_code,
+							 provider_name, plan_name,
+							 &apn, &username, &password,
+							 NULL, &error);
+
+	g_mutex_lock (&db->lock);
+	g_object_unref (service);
+
+	if (!ret) {
+		g_free (key);
+		/* Unknown plans are an error on the bus, not a service failure */
+		if (mobile_provider_service_not_found (error)) {
+			g_error_free (error);
+			return NULL;
+		}
+		mobile_provider_service_failed (db, error);
+		return NULL;
+	}
+
+	info = g_slice_new0 (PlanInfo);
+	info->apn = apn;
+	info->username = empty_to_null (username);
+	info->password = empty_to_null (password);
+
+	return mobile_provider_service_keep (db->remote_plan_info, key,
+					     info, (GDestroyNotify) servicexml_plan_info_free);
+}
+
+static const PlanInfo *
+mobile_provider_service_get_mms_info (MobileProviderDatabase *db,
+				      const gchar *country_code,
+				      const gchar *provider_name)
+{
+	ProviderDatabase *service;
+	GError *error = NULL;
+	gpointer value;
+	PlanInfo *info;
+	gchar *key, *apn, *username, *password, *mmsc, *mmsproxy;
+	gboolean ret;
+
+	key = g_strjoin ("/", country_code, provider_name, NULL);
+
+	if (g_hash_table_lookup_extended (db->remote_mms_info, key, NULL, &value)) {
+		g_free (key);
+		return value;
+	}
+
+	service = g_object_ref (db->service);
+	g_mutex_unlock (&db->lock);
+
+	ret = provider_database_call_get_mms_info_sync (service, country_code, provider_name,
+							&apn, &username, &password,
+							&mmsc, &mmsproxy, NULL, &error);
+
+	g_mutex_lock (&db->lock);
+	g_object_unref (service);
+
+	if (!ret) {
+		/* No MMS for this provider, remember that too */
+		if (mobile_provider_service_not_found (error)) {
+			g_error_free (error);
+			return mobile_provider_service_keep (db->remote_mms_info, key, NULL,
+							     (GDestroyNotify) remote_plan_info_free);
+		}
+		g_free (key);
+		mobile_provider_service_failed (db, error);
+		return NULL;
+	}
+
+	info = g_slice_new0 (PlanInfo);
+	info->apn = apn;
+	info->username = empty_to_null (username);
+	info->password = empty_to_null (password);
+	info->mmsc = empty_to_null (mmsc);
+	info->mmsproxy = empty_to_null (mmsproxy);
+
+	return mobile_provider_service_keep (db->remote_mms_info, key,
+					     info, (GDestroyNotify) remote_plan_info_free);
+}
+
+static const gchar *
+mobile_provider_service_get_country_code_from_mcc (MobileProviderDatabase *db, const gchar *mcc)
+{
+	ProviderDatabase *service;
+	GError *error = NULL;
+	gpointer code;
+	gchar *country_code;
+	gboolean ret;
+
+	if (g_hash_table_lookup_extended (db->mcc_info, mcc, NULL, &code))
+		return code;
+
+	service = g_object_ref (db->service);
+	g_mutex_unlock (&db->lock);
+
+	ret = provider_database_call_get_country_code_from_mcc_sync (service, mcc,
+								     &country_code, NULL, &error);
+
+	g_mutex_lock (&db->lock);
+	g_object_unref (service);
+
+	if (!ret) {
+		if (mobile_provider_service_not_found (error)) {
+			g_error_free (error);
+			/* Remember misses as well */
+			return mobile_provider_service_keep (db->mcc_info, g_strdup (mcc), NULL,
+							     (GDestroyNotify) g_free);
+		}
+		mobile_provider_service_failed (db, error);
+		return NULL;
+	}
+
+	return mobile_provider_service_keep (db->mcc_info, g_strdup (mcc),
+					     country_code, (GDestroyNotify) g_free);
+}
+
+/***** end of provider database service *******/
+
+static void
+add_overlays (GPtrArray *files, const gchar *dirname)
+{
+	GPtrArray *overlays;
+	const gchar *name;
+	GDir *dir;
+	guint i;
 
-	providers = (GHashTable *) g_hash_table_lookup (country_info, country_code);
-	if (providers == NULL)
-		return NULL;
+	dir = g_dir_open (dirname, 0, NULL);
+	if (dir == NULL)
+		return;
+
+	overlays = g_ptr_array_new ();
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		if (g_str_has_suffix (name, ".xml") ||
+		    g_str_has_suffix (name, ".xml.gz") ||
+		    g_str_has_suffix (name, ".xml.xz"))
+			g_ptr_array_add (overlays, g_build_filename (dirname, name, NULL));
+	}
+	g_dir_close (dir);
+
+	g_ptr_array_sort (overlays, compare_strings);
+
+	for (i = 0; i < overlays->len; i++)
+		g_ptr_array_add (files, overlays->pdata[i]);
+
+	g_ptr_array_free (overlays, TRUE);
+}
+
+/* Distributions may ship the system database compressed only */
+static gchar *
+system_database (void)
+{
+	static const gchar *suffixes[] = { "", ".xz", ".gz" };
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (suffixes); i++) {
+		gchar *filename = g_strconcat (MOBILE_BROADBAND_PROVIDER_INFO, suffixes[i], NULL);
+
+		if (g_file_test (filename, G_FILE_TEST_EXISTS))
+			return filename;
+		g_free (filename);
+	}
+
+	return g_strdup (MOBILE_BROADBAND_PROVIDER_INFO);
+}
 
-	provider_list = g_hash_table_get_keys (providers);
-	if (provider_list == NULL)
+/* System database first, then vendor and site overlays in name order */
+gchar **
+mobile_provider_database_get_default_files (void)
+{
+	GPtrArray *files;
+
+	files = g_ptr_array_new ();
+
+	g_ptr_array_add (files, system_database ());
+	add_overlays (files, PROVIDER_OVERLAY_VENDOR_DIR);
+	add_overlays (files, PROVIDER_OVERLAY_SITE_DIR);
+	g_ptr_array_add (files, NULL);
+
+	return (gchar **) g_ptr_array_free (files, FALSE);
+}
+
+MobileProviderDatabase *
+mobile_provider_database_new (MobileProviderDatabaseFlags flags, GError **error)
+{
+	return mobile_provider_database_new_for_files (NULL, flags, error);
+}
+
+MobileProviderDatabase *
+mobile_provider_database_new_for_files (const gchar * const *files,
+					MobileProviderDatabaseFlags flags,
+					GError **error)
+{
+	MobileProviderDatabase *db;
+
+	db = g_slice_new0 (MobileProviderDatabase);
+	db->ref_count = 1;
+	db->flags = flags;
+	g_mutex_init (&db->lock);
+
+	if (files)
+		db->files = g_strdupv ((gchar **) files);
+	else
+		db->files = mobile_provider_database_get_default_files ();
+
+	db->mcc_info = g_hash_table_new_full (g_str_hash, g_str_equal,
+					      (GDestroyNotify) g_free,
+					      (GDestroyNotify) g_free);
+	db->plan_views = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+						NULL, plan_view_free);
+	db->country_info = g_hash_table_new_full (g_str_hash, g_str_equal,
+						  (GDestroyNotify) g_free,
+						  (GDestroyNotify) country_free);
+	db->iso_names = g_hash_table_new_full (g_str_hash, g_str_equal,
+					       (GDestroyNotify) g_free,
+					       (GDestroyNotify) g_free);
+
+	if ((flags & MOBILE_PROVIDER_DATABASE_FLAGS_USE_SERVICE) &&
+	    mobile_provider_service_connect (db)) {
+		db->remote = TRUE;
+		return db;
+	}
+
+	if (!mobile_provider_database_load (db, error)) {
+		mobile_provider_database_unref (db);
 		return NULL;
+	}
+
+	return db;
+}
+
+/* One database shared by everybody in the process, loaded on first use */
+MobileProviderDatabase *
+mobile_provider_database_get_default (GError **error)
+{
+	static GMutex default_lock;
+	static MobileProviderDatabase *default_db = NULL;
+	MobileProviderDatabase *db = NULL;
+
+	g_mutex_lock (&default_lock);
+
+	if (default_db == NULL)
+		default_db = mobile_provider_database_new (MOBILE_PROVIDER_DATABASE_FLAGS_NONE, error);
+
+	if (default_db)
+		db = mobile_provider_database_ref (default_db);
+
+	g_mutex_unlock (&default_lock);
+
+	return db;
+}
+
+MobileProviderDatabase *
+mobile_provider_database_ref (MobileProviderDatabase *db)
+{
+	g_return_val_if_fail (db != NULL, NULL);
+
+	g_atomic_int_inc (&db->ref_count);
+
+	return db;
+}
+
+void
+mobile_provider_database_unref (MobileProviderDatabase *db)
+{
+	g_return_if_fail (db != NULL);
+
+	if (!g_atomic_int_dec_and_test (&db->ref_count))
+		return;
+
+	g_clear_object (&db->service);
+	if (db->local)
+		mobile_provider_database_unref (db->local);
+
+	if (db->remote_providers)
+		g_hash_table_destroy (db->remote_providers);
+	if (db->remote_plans)
+		g_hash_table_destroy (db->remote_plans);
+	if (db->remote_plan_info)
+		g_hash_table_destroy (db->remote_plan_info);
+	if (db->remote_mms_info)
+		g_hash_table_destroy (db->remote_mms_info);
+
+	if (db->country_codes)
+		g_hash_table_destroy (db->country_codes);
+	g_hash_table_destroy (db->iso_names);
+	g_hash_table_destroy (db->country_info);
+	g_hash_table_destroy (db->mcc_info);
+	g_free (db->mcc_table);
+	g_hash_table_destroy (db->plan_views);
+	g_free (db->pool);
+	g_free (db->country_names);
+	g_strfreev (db->files);
+
+	g_mutex_clear (&db->lock);
+
+	g_slice_free (MobileProviderDatabase, db);
+}
+
+/************ HELPER FUNCTIONS FOR MOBILE PROVIDER *********/
+
+static const gchar *
+translate_country (const gchar *iso_name)
+{
+	return dgettext ("iso_3166", iso_name);
+}
+
+/*
+ * Translate the country names the first time somebody needs them, in
+ * whatever locale is set by then. Headless users that only go by code
+ * or MCC never pay for the catalog lookups.
+ */
+static void
+translate_countries (MobileProviderDatabase *db)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+
+	if (!g_once_init_enter (&db->country_names))
+		return;
+
+	db->country_codes = g_hash_table_new (g_str_hash, g_str_equal);
+
+	g_hash_table_iter_init (&iter, db->iso_names);
+	while (g_hash_table_iter_next (&iter, &key, &value))
+		g_hash_table_insert (db->country_codes,
+				     (gpointer) translate_country (value), key);
+
+	if (db->mcc_table) {
+		guint i;
+
+		for (i = 0; i < MCC_TABLE_SIZE; i++) {
+			const gchar *iso_name;
+
+			if (db->mcc_table[i].code == NULL)
+				continue;
+
+			iso_name = g_hash_table_lookup (db->iso_names, db->mcc_table[i].code);
+			if (iso_name)
+				db->mcc_table[i].name = translate_country (iso_name);
+		}
+	}
+
+	g_once_init_leave (&db->country_names, sorted_keys (db->country_codes));
+}
+
+/* Once the service failed, the database loaded in its place */
+static MobileProviderDatabase *
+mobile_provider_database_answering (MobileProviderDatabase *db)
+{
+	MobileProviderDatabase *local;
 
-	provider_list = g_list_sort (provider_list, (GCompareFunc) strcmp);
+	g_mutex_lock (&db->lock);
+	local = db->local;
+	g_mutex_unlock (&db->lock);
 
-	return provider_list;
+	return local ? local : db;
 }
 
-GList *mobile_provider_get_plan_list (const gchar *country_name, const gchar *provider_name)
+static Country *
+lookup_country (MobileProviderDatabase *db, const gchar *country_name)
 {
-	GList *plan_list = NULL;
-	GHashTable *providers = NULL;
-	GHashTable *plans = NULL;
-	gchar *country_code = NULL;
+	const gchar *country_code;
+
+	if (country_name == NULL)
+		return NULL;
+
+	translate_countries (db);
 
-	country_code = g_hash_table_lookup (country_codes, country_name);
+	country_code = g_hash_table_lookup (db->country_codes, country_name);
 	if (country_code == NULL)
 		return NULL;
 
-	providers = (GHashTable *) g_hash_table_lookup (country_info, country_code);
-	if (providers == NULL)
+	return g_hash_table_lookup (db->country_info, country_code);
+}
+
+static Provider *
+lookup_provider (MobileProviderDatabase *db, const gchar *country_name, const gchar *provider_name)
+{
+	Country *country;
+
+	country = lookup_country (db, country_name);
+	if (country == NULL || provider_name == NULL)
+		return NULL;
+
+	return g_hash_table_lookup (country->providers, provider_name);
+}
+
+const gchar * const *
+mobile_provider_database_get_countries (MobileProviderDatabase *db)
+{
+	g_return_val_if_fail (db != NULL, NULL);
+
+	translate_countries (db);
+
+	return db->country_names;
+}
+
+const gchar * const *
+mobile_provider_database_get_providers (MobileProviderDatabase *db, const gchar *country_name)
+{
+	const gchar * const *providers = NULL;
+	Country *country;
+	MobileProviderDatabase *local;
+
+	g_return_val_if_fail (db != NULL, NULL);
+
+	if (db->remote) {
+		const gchar *country_code;
+
+		g_mutex_lock (&db->lock);
+
+		country_code = mobile_provider_database_get_code_from_country (db, country_name);
+		if (country_code && db->service)
+			providers = mobile_provider_service_get_providers (db, country_code);
+
+		local = db->local;
+		g_mutex_unlock (&db->lock);
+
+		/* Still using the service, or it failed and nothing could be loaded */
+		if (local == NULL)
+			return providers;
+
+		db = local;
+	}
+
+	country = lookup_country (db, country_name);
+	if (country == NULL)
 		return NULL;
 
+	return country->provider_names;
+}
+
+const gchar * const *
+mobile_provider_database_get_plans (MobileProviderDatabase *db,
+				    const gchar *country_name,
+				    const gchar *provider_name)
+{
+	const gchar * const *plans = NULL;
+	Provider *provider;
+	MobileProviderDatabase *local;
+
+	g_return_val_if_fail (db != NULL, NULL);
+
+	if (db->remote) {
+		const gchar *country_code;
+
+		g_mutex_lock (&db->lock);
+
+		country_code = mobile_provider_database_get_code_from_country (db, country_name);
+		if (country_code && provider_name && db->service)
+			plans = mobile_provider_service_get_plans (db, country_code, provider_name);
+
+		local = db->local;
+		g_mutex_unlock (&db->lock);
+
+		if (local == NULL)
+			return plans;
+
+		db = local;
+	}
+
 	/* if the provider is found, then return the plans */
-	plans = (GHashTable *) g_hash_table_lookup (providers, provider_name);
-	if (plans == NULL)
+	provider = lookup_provider (db, country_name, provider_name);
+	if (provider == NULL)
 		return NULL;
 
-	plan_list = g_hash_table_get_keys (plans);
-	if (plan_list == NULL)
+	return provider->plan_names;
+}
+
+/* A PlanInfo borrowing the record's strings from the pool, made once */
+static const PlanInfo *
+plan_view (MobileProviderDatabase *db, const PlanRecord *record)
+{
+	PlanInfo *info;
+
+	g_mutex_lock (&db->lock);
+
+	info = g_hash_table_lookup (db->plan_views, record);
+	if (info == NULL) {
+		info = g_slice_new0 (PlanInfo);
+		info->apn = pool_string (db, record->apn);
+		info->username = pool_string (db, record->username);
+		info->password = pool_string (db, record->password);
+
+		g_hash_table_insert (db->plan_views, (gpointer) record, info);
+	}
+
+	g_mutex_unlock (&db->lock);
+
+	return info;
+}
+
+const PlanInfo *
+mobile_provider_database_get_plan_info (MobileProviderDatabase *db,
+					const gchar *country_name,
+					const gchar *provider_name,
+					const gchar *plan_name)
+{
+	const PlanInfo *plan_info = NULL;
+	Provider *provider;
+	MobileProviderDatabase *local;
+	guint i;
+
+	g_return_val_if_fail (db != NULL, NULL);
+
+	if (db->remote) {
+		const gchar *country_code;
+
+		g_mutex_lock (&db->lock);
+
+		country_code = mobile_provider_database_get_code_from_country (db, country_name);
+		if (country_code && provider_name && plan_name && db->service)
+			plan_info = mobile_provider_service_get_plan_info (db, country_code,
+									   provider_name, plan_name);
+
+		local = db->local;
+		g_mutex_unlock (&db->lock);
+
+		if (local == NULL)
+			return plan_info;
+
+		db = local;
+	}
+
+	provider = lookup_provider (db, country_name, provider_name);
+	if (provider == NULL || plan_name == NULL)
 		return NULL;
 
-	plan_list = g_list_sort (plan_list, (GCompareFunc) strcmp);
+	for (i = 0; i < provider->n_records; i++) {
+		if (!strcmp (provider->plan_names[i], plan_name))
+			return plan_view (db, &provider->records[i]);
+	}
 
-	return plan_list;
+	return NULL;
 }
 
-PlanInfo *mobile_provider_get_plan_info (const gchar *country_name,
-					 const gchar *provider_name,
-					 const gchar *plan_name)
+const PlanInfo *
+mobile_provider_database_get_mms_info (MobileProviderDatabase *db,
+				       const gchar *country_name,
+				       const gchar *provider_name)
 {
-	PlanInfo *plan_info = NULL;
+	const PlanInfo *mms_info = NULL;
+	Provider *provider;
+	MobileProviderDatabase *local;
 
-	GHashTable *providers = NULL;
-	GHashTable *plans = NULL;
-	gchar *country_code = NULL;
+	g_return_val_if_fail (db != NULL, NULL);
 
-	country_code = g_hash_table_lookup (country_codes, country_name);
-	if (country_code == NULL)
+	if (db->remote) {
+		const gchar *country_code;
+
+		g_mutex_lock (&db->lock);
+
+		country_code = mobile_provider_database_get_code_from_country (db, country_name);
+		if (country_code && provider_name && db->service)
+			mms_info = mobile_provider_service_get_mms_info (db, country_code, provider_name);
+
+		local = db->local;
+		g_mutex_unlock (&db->lock);
+
+		if (local == NULL)
+			return mms_info;
+
+		db = local;
+	}
+
+	provider = lookup_provider (db, country_name, provider_name);
+	if (provider == NULL)
 		return NULL;
 
-	providers = (GHashTable *) g_hash_table_lookup (country_info, country_code);
-	if (providers == NULL)
+	return provider->mms;
+}
+
+const gchar *
+mobile_provider_database_get_country_from_code (MobileProviderDatabase *db, const gchar *code)
+{
+	const gchar *iso_name;
+
+	g_return_val_if_fail (db != NULL, NULL);
+
+	if (code == NULL)
 		return NULL;
 
-	plans = (GHashTable *) g_hash_table_lookup (providers, provider_name);
-	if (plans == NULL)
+	iso_name = g_hash_table_lookup (db->iso_names, code);
+	if (iso_name == NULL)
 		return NULL;
 
+	return translate_country (iso_name);
+}
+
+const gchar *
+mobile_provider_database_get_code_from_country (MobileProviderDatabase *db, const gchar *country_name)
+{
+	g_return_val_if_fail (db != NULL, NULL);
 
-	plan_info = g_hash_table_lookup (plans, plan_name);
-	if (plan_info == NULL)
+	if (country_name == NULL)
 		return NULL;
 
-	return plan_info;
+	translate_countries (db);
+
+	return g_hash_table_lookup (db->country_codes, country_name);
 }
 
-gchar *mobile_provider_get_country_from_code (gchar *code)
+const gchar *
+mobile_provider_database_get_country_code_from_mcc (MobileProviderDatabase *db, const gchar *mcc)
 {
-	GHashTableIter iter;
-	gpointer key, value;
+	const gchar *country_code = NULL;
+	MobileProviderDatabase *local;
+	gint index;
 
-	if (code == NULL)
+	g_return_val_if_fail (db != NULL, NULL);
+
+	if (mcc == NULL)
 		return NULL;
 
-	g_hash_table_iter_init (&iter, country_codes);
+	if (db->remote) {
+		g_mutex_lock (&db->lock);
 
-	while (g_hash_table_iter_next (&iter, &key, &value))
-	{
-		if (!strcmp ((gchar *)value, code))
-			return (gchar *) key;
+		if (db->service)
+			country_code = mobile_provider_service_get_country_code_from_mcc (db, mcc);
+
+		local = db->local;
+		g_mutex_unlock (&db->lock);
+
+		if (local == NULL)
+			return country_code;
+
+		db = local;
 	}
 
-	return NULL;
+	index = mcc_index (mcc);
+	if (index < 0)
+		return NULL;
+
+	/* Country codes are upper-cased when the database is parsed */
+	return db->mcc_table[index].code;
 }
 
-gchar *mobile_provider_get_country_code_from_mcc (gchar *mcc)
+const gchar *
+mobile_provider_database_get_country_from_mcc (MobileProviderDatabase *db, const gchar *mcc)
 {
-	gchar *country_code;
+	gint index;
 
-	country_code =  g_hash_table_lookup (mcc_info, mcc);
-	if (country_code)
-		return g_ascii_strup (country_code, -1);
-	else
+	g_return_val_if_fail (db != NULL, NULL);
+
+	if (mcc == NULL)
+		return NULL;
+
+	if (db->remote)
+		return mobile_provider_database_get_country_from_code (db,
+			mobile_provider_database_get_country_code_from_mcc (db, mcc));
+
+	index = mcc_index (mcc);
+	if (index < 0)
 		return NULL;
+
+	translate_countries (db);
+
+	return db->mcc_table[index].name;
 }
 
-/************** TEST THE SERVICEXML TABLES & COUNTRY CODES ****************/
-void for_each_plan (gpointer plan_name, gpointer plan_info, gpointer user_data)
+gboolean
+mobile_provider_database_uses_service (MobileProviderDatabase *db)
 {
-	PlanInfo *info = plan_info;
+	gboolean uses_service;
 
-	g_printerr ("\t\tPlan:%s\n", (gchar *) plan_name);
+	g_return_val_if_fail (db != NULL, FALSE);
 
-	if (plan_info) {
-		g_printerr ("\t\t\tAPN:%s\n", info->apn);
-		g_printerr ("\t\t\tUsername:%s\n", info->username);
-		g_printerr ("\t\t\tPassword:%s\n\n", info->password);
-	}
+	g_mutex_lock (&db->lock);
+	uses_service = db->service != NULL;
+	g_mutex_unlock (&db->lock);
+
+	return uses_service;
 }
 
-void for_each_provider (gpointer provider, gpointer plan_info, gpointer user_data)
+/************** MEMORY STATISTICS ****************/
+
+/* Roughly sizeof (GHashTable), which is private */
+#define HASH_TABLE_STRUCT_SIZE (12 * sizeof (gpointer))
+
+/*
+ * GHashTable keeps a power of two buckets, at least 8 and more than
+ * 4/3 of the entries, each with a key, a value and a hash.
+ */
+static gsize
+hash_table_bytes (GHashTable *table)
 {
-	g_printerr ("\tProvider:%s\n", (gchar *) provider);
+	guint n_buckets = 8;
+	guint wanted = g_hash_table_size (table) * 4 / 3;
+
+	while (n_buckets <= wanted)
+		n_buckets <<= 1;
+
+	return HASH_TABLE_STRUCT_SIZE + n_buckets * (2 * sizeof (gpointer) + sizeof (guint));
+}
 
-	if (plan_info)
-		g_hash_table_foreach (plan_info, for_each_plan, NULL);
+static gsize
+string_bytes (const gchar *str)
+{
+	return str ? strlen (str) + 1 : 0;
 }
 
-void for_each_country (gpointer country_code, gpointer provider_info, gpointer user_data)
+static gsize
+name_array_bytes (const gchar **names)
 {
+	guint n = 0;
 
-	g_printerr ("\n\nCode:%s\n", (gchar *) country_code);
+	if (names == NULL)
+		return 0;
+
+	while (names[n])
+		n++;
 
-	if (provider_info)
-	g_hash_table_foreach (provider_info, for_each_provider, NULL);
+	return (n + 1) * sizeof (gchar *);
 }
 
-void print_country_codes (gpointer country_name, gpointer user_data)
+static void
+string_table_stats (GHashTable *table, MobileProviderTableStats *stats)
 {
-  g_printerr ("%s : %s\n", (gchar *) country_name,  (gchar *) g_hash_table_lookup (country_codes, (gchar *) country_name));
+	GHashTableIter iter;
+	gpointer key, value;
+
+	stats->count = g_hash_table_size (table);
+	stats->tables = hash_table_bytes (table);
+
+	g_hash_table_iter_init (&iter, table);
+	while (g_hash_table_iter_next (&iter, &key, &value))
+		stats->strings += string_bytes (key) + string_bytes (value);
 }
 
-void print_test (gpointer data, gpointer user_data)
+static gsize
+table_stats_total (const MobileProviderTableStats *stats)
 {
-  g_printerr ("%s\n", (gchar *) data);
+	return stats->strings + stats->tables + stats->records;
 }
 
 void
-mobile_provider_test()
+mobile_provider_database_get_stats (MobileProviderDatabase *db,
+				    MobileProviderDatabaseStats *stats)
 {
-	GList *country_code_list = NULL;
-	GList *test = NULL;
-	PlanInfo *data;
-	country_code_list = g_hash_table_get_keys (country_codes);
+	GHashTableIter country_iter, provider_iter;
+	gpointer key, value;
 
-	country_code_list = g_list_sort (country_code_list, (GCompareFunc) strcmp);
+	g_return_if_fail (db != NULL);
+	g_return_if_fail (stats != NULL);
 
-	g_printerr ("****** DATABASE OF COUNTRY CODE *******\n");
+	memset (stats, 0, sizeof (MobileProviderDatabaseStats));
 
-	g_list_foreach (country_code_list, print_country_codes, NULL);
+	db = mobile_provider_database_answering (db);
 
-	g_printerr ("****** DATABASE OF SERVICE PROVIDERS *******\n");
-	g_hash_table_foreach (country_info, for_each_country, NULL);
+	/* mcc_info fills on demand when using the service, plan_views always */
+	g_mutex_lock (&db->lock);
+
+	/* Translated names belong to the catalog, don't translate just to count */
+	string_table_stats (db->iso_names, &stats->country_codes);
+	if (g_atomic_pointer_get (&db->country_names)) {
+		stats->country_codes.tables += hash_table_bytes (db->country_codes) +
+					       name_array_bytes (db->country_names);
+	}
+
+	string_table_stats (db->mcc_info, &stats->mcc_info);
+	if (db->mcc_table)
+		stats->mcc_info.tables += MCC_TABLE_SIZE * sizeof (MccCountry);
+
+	stats->country_info.count = g_hash_table_size (db->country_info);
+	stats->country_info.tables = hash_table_bytes (db->country_info);
+	stats->country_info.records = stats->country_info.count * sizeof (Country);
+
+	g_hash_table_iter_init (&country_iter, db->country_info);
+	while (g_hash_table_iter_next (&country_iter, &key, &value)) {
+		Country *country = value;
+
+		stats->country_info.strings += string_bytes (key);
+
+		stats->providers.count += g_hash_table_size (country->providers);
+		stats->providers.tables += hash_table_bytes (country->providers) +
+					   name_array_bytes (country->provider_names);
+
+		g_hash_table_iter_init (&provider_iter, country->providers);
+		while (g_hash_table_iter_next (&provider_iter, &key, &value)) {
+			Provider *provider = value;
+
+			stats->providers.strings += string_bytes (key);
+			stats->providers.records += sizeof (Provider);
+
+			if (provider->mms) {
+				stats->plans.strings += string_bytes (provider->mms->apn) +
+							string_bytes (provider->mms->username) +
+							string_bytes (provider->mms->password) +
+							string_bytes (provider->mms->mmsc) +
+							string_bytes (provider->mms->mmsproxy);
+				stats->plans.records += sizeof (PlanInfo);
+			}
+
+			stats->plans.count += provider->n_records;
+			stats->plans.tables += name_array_bytes (provider->plan_names);
+			stats->plans.records += provider->n_records * sizeof (PlanRecord);
+		}
+	}
+
+	/* Plan strings are all in the pool, shared */
+	stats->plans.strings += db->pool_size;
+	stats->plans.tables += hash_table_bytes (db->plan_views);
+	stats->plans.records += g_hash_table_size (db->plan_views) * sizeof (PlanInfo);
+
+	stats->input_peak = db->input_peak;
+
+	g_mutex_unlock (&db->lock);
+
+	stats->total = table_stats_total (&stats->country_codes) +
+		       table_stats_total (&stats->mcc_info) +
+		       table_stats_total (&stats->country_info) +
+		       table_stats_total (&stats->providers) +
+		       table_stats_total (&stats->plans);
+}
+
+static void
+print_table_stats (const gchar *name, const MobileProviderTableStats *stats)
+{
+	g_print ("%-14s %8u %10" G_GSIZE_FORMAT " %10" G_GSIZE_FORMAT
+		 " %10" G_GSIZE_FORMAT " %10" G_GSIZE_FORMAT "\n",
+		 name, stats->count, stats->strings, stats->tables,
+		 stats->records, table_stats_total (stats));
+}
 
-	g_list_free_full (country_code_list, g_free);
+void
+mobile_provider_database_print_stats (MobileProviderDatabase *db)
+{
+	MobileProviderDatabaseStats stats;
+
+	g_return_if_fail (db != NULL);
+
+	mobile_provider_database_get_stats (db, &stats);
+
+	g_print ("%-14s %8s %10s %10s %10s %10s\n",
+		 "table", "entries", "strings", "tables", "records", "bytes");
+	print_table_stats ("country_codes", &stats.country_codes);
+	print_table_stats ("mcc_info", &stats.mcc_info);
+	print_table_stats ("country_info", &stats.country_info);
+	print_table_stats ("providers", &stats.providers);
+	print_table_stats ("plans", &stats.plans);
+
+	g_print ("\ntotal: %" G_GSIZE_FORMAT " bytes\n", stats.total);
+	g_print ("input peak: %" G_GSIZE_FORMAT " bytes\n", stats.input_peak);
+}
+
+/************** DUMP THE SERVICEXML TABLES & COUNTRY CODES ****************/
+static void
+for_each_plan (MobileProviderDatabase *db, const PlanRecord *record)
+{
+	g_printerr ("\t\tPlan:%s\n", pool_string (db, record->name));
+	g_printerr ("\t\t\tAPN:%s\n", pool_string (db, record->apn));
+	g_printerr ("\t\t\tUsername:%s\n", pool_string (db, record->username));
+	g_printerr ("\t\t\tPassword:%s\n\n", pool_string (db, record->password));
+}
+
+static void
+for_each_provider (gpointer provider_name, gpointer provider, gpointer user_data)
+{
+	PlanInfo *mms = ((Provider *) provider)->mms;
+	guint i;
+
+	g_printerr ("\tProvider:%s\n", (gchar *) provider_name);
+
+	for (i = 0; i < ((Provider *) provider)->n_records; i++)
+		for_each_plan (user_data, &((Provider *) provider)->records[i]);
 
-	g_printerr ("****** TEST *******\n");
+	if (mms) {
+		g_printerr ("\t\tMMS APN:%s\n", mms->apn);
+		g_printerr ("\t\t\tMMSC:%s\n", mms->mmsc);
+		g_printerr ("\t\t\tMMS Proxy:%s\n\n", mms->mmsproxy);
+	}
+}
+
+static void
+for_each_country (gpointer country_code, gpointer country, gpointer user_data)
+{
+
+	g_printerr ("\n\nCode:%s\n", (gchar *) country_code);
+
+	g_hash_table_foreach (((Country *) country)->providers, for_each_provider, user_data);
+}
+
+void
+mobile_provider_database_dump (MobileProviderDatabase *db)
+{
+	const gchar * const *name;
 
-	test = mobile_provider_get_provider_list ("United Kingdom");
-	g_list_foreach (test, print_test, NULL);
-	g_list_free (test);
+	g_return_if_fail (db != NULL);
 
-	g_printerr ("\n");
-	test = mobile_provider_get_plan_list ("United Kingdom", "O2");
-	g_list_foreach (test, print_test, NULL);
-	g_list_free (test);
+	db = mobile_provider_database_answering (db);
 
-	g_printerr ("\n");
-	data = mobile_provider_get_plan_info ("United Kingdom", "O2", "Pay and Go (Prepaid)");
-	g_printerr ("APN:%s\n", data->apn);
-	g_printerr ("UserName:%s\n", data->username);
-	g_printerr ("Password:%s\n", data->password);
+	g_printerr ("****** DATABASE OF COUNTRY CODE *******\n");
+
+	for (name = mobile_provider_database_get_countries (db); name && *name; name++)
+		g_printerr ("%s : %s\n", *name,
+			    (gchar *) g_hash_table_lookup (db->country_codes, *name));
+
+	g_printerr ("****** DATABASE OF SERVICE PROVIDERS *******\n");
+	g_hash_table_foreach (db->country_info, for_each_country, db);
 }
@@ -27,22 +27,132 @@
 #ifndef MOBILE_PROVIDER_H
 #define MOBILE_PROVIDER_H
 
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define MOBILE_PROVIDER_ERROR (mobile_provider_error_quark ())
+
+typedef enum {
+	MOBILE_PROVIDER_ERROR_FORMAT,
+	MOBILE_PROVIDER_ERROR_PARSE
+} MobileProviderError;
+
+typedef enum {
+	MOBILE_PROVIDER_DATABASE_FLAGS_NONE        = 0,
+	/* Forward lookups to the provider database service when it runs */
+	MOBILE_PROVIDER_DATABASE_FLAGS_USE_SERVICE = 1 << 0,
+	/* Always parse the files, never read or write the merged cache */
+	MOBILE_PROVIDER_DATABASE_FLAGS_NO_CACHE    = 1 << 1
+} MobileProviderDatabaseFlags;
+
+typedef struct _MobileProviderDatabase MobileProviderDatabase;
+
+/* Borrowed from the database, never freed by the caller */
 typedef struct _PlanInfo
 {
-  char *apn;
-  char *username;
-  char *password;
+	const gchar *apn;
+	const gchar *username;
+	const gchar *password;
+
+	/* MMS APNs only */
+	const gchar *mmsc;
+	const gchar *mmsproxy;
 } PlanInfo;
 
-GList *mobile_provider_get_country_list ();
-GList *mobile_provider_get_provider_list (const gchar *country_name);
-GList *mobile_provider_get_plan_list (const gchar *country_name, const gchar *provider_name);
+/* Bytes are estimates of what the allocations cost, not malloc overhead */
+typedef struct {
+	guint count;		/* entries in the table(s) */
+	gsize strings;		/* keys, values and plan details */
+	gsize tables;		/* GHashTable buckets and sorted name arrays */
+	gsize records;		/* Country, Provider, PlanRecord and PlanInfo structs */
+} MobileProviderTableStats;
+
+typedef struct {
+	MobileProviderTableStats country_codes;
+	MobileProviderTableStats mcc_info;
+	MobileProviderTableStats country_info;
+	MobileProviderTableStats providers;	/* all the per-country tables */
+	MobileProviderTableStats plans;		/* all the per-provider tables */
+
+	gsize total;
+
+	/*
+	 * Most bytes held at once while loading for file contents or read
+	 * buffers and the merged cache image, read or written. The tables
+	 * being built are not counted, they're in the totals once loaded.
+	 */
+	gsize input_peak;
+} MobileProviderDatabaseStats;
+
+GQuark mobile_provider_error_quark (void);
+
+/*
+ * A loaded database is read-only and may be used from any thread.
+ * All returned strings, arrays and PlanInfos are owned by the database
+ * and stay valid until the last reference is dropped.
+ */
+MobileProviderDatabase *mobile_provider_database_new (MobileProviderDatabaseFlags flags,
+						      GError **error);
+/*
+ * Files are layered in order: countries, providers and plans found in a
+ * later file are merged over the earlier ones. NULL means the default
+ * list, see mobile_provider_database_get_default_files().
+ */
+MobileProviderDatabase *mobile_provider_database_new_for_files (const gchar * const *files,
+								MobileProviderDatabaseFlags flags,
+								GError **error);
+MobileProviderDatabase *mobile_provider_database_get_default (GError **error);
+gchar **mobile_provider_database_get_default_files (void);
+MobileProviderDatabase *mobile_provider_database_ref (MobileProviderDatabase *db);
+void mobile_provider_database_unref (MobileProviderDatabase *db);
+
+/*
+ * NULL-terminated, sorted in the locale's collation order. Providers
+ * and plans are sorted when the database loads. Countries are listed
+ * only if they have providers. They are translated and sorted in the
+ * locale set when country names are first needed.
+ */
+const gchar * const *mobile_provider_database_get_countries (MobileProviderDatabase *db);
+const gchar * const *mobile_provider_database_get_providers (MobileProviderDatabase *db,
+							    const gchar *country_name);
+const gchar * const *mobile_provider_database_get_plans (MobileProviderDatabase *db,
+							const gchar *country_name,
+							const gchar *provider_name);
+
+const PlanInfo *mobile_provider_database_get_plan_info (MobileProviderDatabase *db,
+							const gchar *country_name,
+							const gchar *provider_name,
+							const gchar *plan_name);
+
+/* The provider's MMS APN, NULL if it has none */
+const PlanInfo *mobile_provider_database_get_mms_info (MobileProviderDatabase *db,
+						       const gchar *country_name,
+						       const gchar *provider_name);
+
+const gchar *mobile_provider_database_get_country_from_code (MobileProviderDatabase *db,
+							    const gchar *code);
+const gchar *mobile_provider_database_get_code_from_country (MobileProviderDatabase *db,
+							    const gchar *country_name);
+const gchar *mobile_provider_database_get_country_code_from_mcc (MobileProviderDatabase *db,
+								const gchar *mcc);
+/* The translated name of the MCC's country, as listed by get_countries */
+const gchar *mobile_provider_database_get_country_from_mcc (MobileProviderDatabase *db,
+							   const gchar *mcc);
+
+/*
+ * TRUE while lookups are forwarded to the provider database service,
+ * and may each cost a D-Bus round trip. Otherwise they're all answered
+ * from memory.
+ */
+gboolean mobile_provider_database_uses_service (MobileProviderDatabase *db);
+
+void mobile_provider_database_get_stats (MobileProviderDatabase *db,
+					MobileProviderDatabaseStats *stats);
+void mobile_provider_database_print_stats (MobileProviderDatabase *db);
 
-PlanInfo *mobile_provider_get_plan_info (const gchar *country_name,
-					 const gchar *provider_name,
-					 const gchar *plan_name);
+void mobile_provider_database_dump (MobileProviderDatabase *db);
 
-gchar *mobile_provider_get_country_from_code (gchar *code);
-gchar *mobile_provider_get_country_code_from_mcc (gchar *mcc);
+G_END_DECLS
 
 #endif /* MOBILE_PROVIDER_H*/
@@ -0,0 +1,794 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *  Authors: Alok Barsode <alok.barsode@intel.com>
+ */
+
+/*
+ * A stand-in for oFono with one modem, so the wizard's D-Bus flow can be
+ * driven and timed without hardware. It owns org.ofono on the session
+ * bus; run it under dbus-run-session to keep it private:
+ *
+ *   dbus-run-session -- sh -c 'ofono-mock --latency 20 &
+ *                              ofono-wizard --bus session --path /mock_0'
+ *
+ * Method keys are "Interface.Method", e.g. "ConnectionContext.SetProperty".
+ * A SetProperty fault may also name the property, as in
+ * "ConnectionContext.SetProperty.Active". oFono's own errors are not known
+ * to GDBus, so they reach the wizard as G_IO_ERROR_DBUS_ERROR (36).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "ofono-manager.h"
+#include "ofono-modem.h"
+#include "ofono-sim.h"
+#include "ofono-connman.h"
+#include "ofono-context.h"
+
+#define OFONO_SERVICE "org.ofono"
+#define OFONO_ERROR_PREFIX "org.ofono.Error."
+
+typedef struct {
+	GDBusInterfaceSkeleton *skeleton;
+	const gchar *interface;		/* short name used in method keys */
+	gchar *path;
+	GHashTable *properties;		/* name (key) <--> GVariant (value) */
+} MockObject;
+
+typedef struct {
+	gchar *error_name;
+	gint remaining;			/* calls left to fail, -1 for all */
+} MockFault;
+
+typedef struct {
+	GDBusMethodInvocation *invocation;
+	GVariant *reply;
+	gchar *error_name;
+
+	/* PropertyChanged to send once the reply is out */
+	gchar *path;
+	const gchar *interface_name;
+	gchar *property;
+	GVariant *value;
+} MockReply;
+
+static GMainLoop *loop = NULL;
+static GDBusConnection *bus = NULL;
+
+static guint default_latency = 0;
+static GHashTable *latencies = NULL;	/* method key (key) <--> ms (value) */
+static GHashTable *faults = NULL;	/* method key (key) <--> MockFault (value) */
+
+static gchar *modem_path = NULL;
+static MockObject *manager = NULL;
+static MockObject *modem = NULL;
+static MockObject *sim_manager = NULL;
+static MockObject *connection_manager = NULL;
+static GPtrArray *contexts = NULL;
+static guint next_context = 1;
+
+static const gchar *modem_interfaces[] = {
+	"org.ofono.SimManager",
+	"org.ofono.ConnectionManager",
+	NULL
+};
+
+static const gchar *no_interfaces[] = { NULL };
+
+/**********************************************************/
+/* Latency and faults */
+/**********************************************************/
+
+static guint
+mock_latency (const gchar *key, const gchar *method)
+{
+	gpointer ms;
+
+	if (g_hash_table_lookup_extended (latencies, key, NULL, &ms) ||
+	    g_hash_table_lookup_extended (latencies, method, NULL, &ms))
+		return GPOINTER_TO_UINT (ms);
+
+	return default_latency;
+}
+
+/* The error to answer with, if this call is meant to fail */
+static const gchar *
+mock_fault (const gchar *key, const gchar *method, const gchar *property)
+{
+	MockFault *fault = NULL;
+
+	if (property) {
+		gchar *property_key = g_strconcat (key, ".", property, NULL);
+
+		fault = g_hash_table_lookup (faults, property_key);
+		g_free (property_key);
+	}
+
+	if (fault == NULL || fault->remaining == 0)
+		fault = g_hash_table_lookup (faults, key);
+	if (fault == NULL || fault->remaining == 0)
+		fault = g_hash_table_lookup (faults, method);
+	if (fault == NULL || fault->remaining == 0)
+		return NULL;
+
+	if (fault->remaining > 0)
+		fault->remaining--;
+
+	return fault->error_name;
+}
+
+static void
+mock_reply_free (MockReply *reply)
+{
+	g_object_unref (reply->invocation);
+	if (reply->reply)
+		g_variant_unref (reply->reply);
+	g_free (reply->error_name);
+	g_free (reply->path);
+	g_free (reply->property);
+	if (reply->value)
+		g_variant_unref (reply->value);
+
+	g_slice_free (MockReply, reply);
+}
+
+static const gchar *
+mock_object_interface_name (MockObject *object)
+{
+	return g_dbus_interface_skeleton_get_info (object->skeleton)->name;
+}
+
+/* By path, the object may be gone by the time a delayed reply goes out */
+static void
+mock_emit_property_changed (const gchar *path,
+			    const gchar *interface_name,
+			    const gchar *name,
+			    GVariant *value)
+{
+	GError *error = NULL;
+
+	if (!g_dbus_connection_emit_signal (bus, NULL, path, interface_name,
+					    "PropertyChanged",
+					    g_variant_new ("(sv)", name, value),
+					    &error)) {
+		g_warning ("Unable to emit PropertyChanged: %s", error->message);
+		g_error_free (error);
+	}
+}
+
+static gboolean
+mock_reply_send (gpointer user_data)
+{
+	MockReply *reply = user_data;
+
+	if (reply->error_name) {
+		g_dbus_method_invocation_return_dbus_error (reply->invocation,
+							    reply->error_name,
+							    "Injected by ofono-mock");
+	} else {
+		g_dbus_method_invocation_return_value (reply->invocation, reply->reply);
+	}
+
+	if (reply->property)
+		mock_emit_property_changed (reply->path, reply->interface_name,
+					    reply->property, reply->value);
+
+	mock_reply_free (reply);
+
+	return FALSE;
+}
+
+/* Answer after the configured latency, takes reply and value */
+static void
+mock_return (const gchar *key,
+	     const gchar *method,
+	     GDBusMethodInvocation *invocation,
+	     GVariant *value,
+	     const gchar *error_name,
+	     MockObject *changed,
+	     const gchar *property,
+	     GVariant *property_value)
+{
+	MockReply *reply;
+	guint latency;
+
+	reply = g_slice_new0 (MockReply);
+	reply->invocation = g_object_ref (invocation);
+	reply->error_name = g_strdup (error_name);
+
+	if (value)
+		reply->reply = g_variant_ref_sink (value);
+
+	if (changed) {
+		reply->path = g_strdup (changed->path);
+		reply->interface_name = mock_object_interface_name (changed);
+		reply->property = g_strdup (property);
+		reply->value = g_variant_ref (property_value);
+	}
+
+	latency = mock_latency (key, method);
+	if (latency == 0)
+		mock_reply_send (reply);
+	else
+		g_timeout_add (latency, mock_reply_send, reply);
+}
+
+/**********************************************************/
+/* Objects */
+/**********************************************************/
+
+static MockObject *
+mock_object_new (gpointer skeleton, const gchar *interface, const gchar *path)
+{
+	MockObject *object;
+
+	object = g_slice_new0 (MockObject);
+	object->skeleton = G_DBUS_INTERFACE_SKELETON (skeleton);
+	object->interface = interface;
+	object->path = g_strdup (path);
+	object->properties = g_hash_table_new_full (g_str_hash, g_str_equal,
+						    (GDestroyNotify) g_free,
+						    (GDestroyNotify) g_variant_unref);
+
+	return object;
+}
+
+static void
+mock_object_free (MockObject *object)
+{
+	if (g_dbus_interface_skeleton_get_connection (object->skeleton))
+		g_dbus_interface_skeleton_unexport (object->skeleton);
+
+	g_object_unref (object->skeleton);
+	g_hash_table_destroy (object->properties);
+	g_free (object->path);
+
+	g_slice_free (MockObject, object);
+}
+
+/* Sinks a floating value, otherwise adds a reference */
+static void
+mock_object_set (MockObject *object, const gchar *name, GVariant *value)
+{
+	g_hash_table_replace (object->properties, g_strdup (name), g_variant_ref_sink (value));
+}
+
+static GVariant *
+mock_object_get_properties (MockObject *object)
+{
+	GVariantBuilder builder;
+	GHashTableIter iter;
+	gpointer key, value;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+
+	g_hash_table_iter_init (&iter, object->properties);
+	while (g_hash_table_iter_next (&iter, &key, &value))
+		g_variant_builder_add (&builder, "{sv}", key, value);
+
+	return g_variant_builder_end (&builder);
+}
+
+static gboolean
+mock_object_export (MockObject *object)
+{
+	GError *error = NULL;
+
+	if (!g_dbus_interface_skeleton_export (object->skeleton, bus, object->path, &error)) {
+		g_warning ("Unable to export %s on %s: %s", object->interface,
+			   object->path, error->message);
+		g_error_free (error);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Same handler for every interface, they all take no arguments */
+static gboolean
+handle_get_properties (GDBusInterfaceSkeleton *skeleton,
+		       GDBusMethodInvocation  *invocation,
+		       MockObject             *object)
+{
+	const gchar *error_name;
+	gchar *key;
+
+	key = g_strconcat (object->interface, ".GetProperties", NULL);
+
+	error_name = mock_fault (key, "GetProperties", NULL);
+	if (error_name)
+		mock_return (key, "GetProperties", invocation, NULL, error_name, NULL, NULL, NULL);
+	else
+		mock_return (key, "GetProperties", invocation,
+			     g_variant_new ("(@a{sv})", mock_object_get_properties (object)),
+			     NULL, NULL, NULL, NULL);
+
+	g_free (key);
+
+	return TRUE;
+}
+
+static gboolean
+handle_set_property (GDBusInterfaceSkeleton *skeleton,
+		     GDBusMethodInvocation  *invocation,
+		     const gchar            *name,
+		     GVariant               *value,
+		     MockObject             *object)
+{
+	const gchar *error_name;
+	GVariant *current, *v;
+	gchar *key;
+
+	key = g_strconcat (object->interface, ".SetProperty", NULL);
+	v = g_variant_get_variant (value);
+
+	current = g_hash_table_lookup (object->properties, name);
+
+	error_name = mock_fault (key, "SetProperty", name);
+	if (error_name == NULL && current == NULL)
+		error_name = OFONO_ERROR_PREFIX "InvalidArguments";
+	if (error_name == NULL && !g_variant_is_of_type (v, g_variant_get_type (current)))
+		error_name = OFONO_ERROR_PREFIX "InvalidFormat";
+
+	/* Like oFono, settings of an active context are locked */
+	if (error_name == NULL && !strcmp (object->interface, "ConnectionContext") &&
+	    strcmp (name, "Active")) {
+		GVariant *active = g_hash_table_lookup (object->properties, "Active");
+
+		if (active && g_variant_get_boolean (active))
+			error_name = OFONO_ERROR_PREFIX "InUse";
+	}
+
+	if (error_name) {
+		mock_return (key, "SetProperty", invocation, NULL, error_name, NULL, NULL, NULL);
+	} else {
+		gboolean changed = !g_variant_equal (current, v);
+
+		mock_object_set (object, name, v);
+		mock_return (key, "SetProperty", invocation, g_variant_new ("()"), NULL,
+			     changed ? object : NULL, name, v);
+	}
+
+	g_variant_unref (v);
+	g_free (key);
+
+	return TRUE;
+}
+
+static void
+add_object_entry (GVariantBuilder *builder, MockObject *object)
+{
+	g_variant_builder_add (builder, "(o@a{sv})", object->path,
+			       mock_object_get_properties (object));
+}
+
+static gboolean
+handle_get_modems (Manager               *object,
+		   GDBusMethodInvocation *invocation,
+		   gpointer               user_data)
+{
+	GVariantBuilder builder;
+	const gchar *error_name;
+
+	error_name = mock_fault ("Manager.GetModems", "GetModems", NULL);
+	if (error_name) {
+		mock_return ("Manager.GetModems", "GetModems", invocation, NULL, error_name,
+			     NULL, NULL, NULL);
+		return TRUE;
+	}
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(oa{sv})"));
+	if (modem)
+		add_object_entry (&builder, modem);
+
+	mock_return ("Manager.GetModems", "GetModems", invocation,
+		     g_variant_new ("(@a(oa{sv}))", g_variant_builder_end (&builder)),
+		     NULL, NULL, NULL, NULL);
+
+	return TRUE;
+}
+
+static gboolean
+handle_get_contexts (ConnectionManager     *object,
+		     GDBusMethodInvocation *invocation,
+		     gpointer               user_data)
+{
+	GVariantBuilder builder;
+	const gchar *error_name;
+	guint i;
+
+	error_name = mock_fault ("ConnectionManager.GetContexts", "GetContexts", NULL);
+	if (error_name) {
+		mock_return ("ConnectionManager.GetContexts", "GetContexts", invocation, NULL,
+			     error_name, NULL, NULL, NULL);
+		return TRUE;
+	}
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(oa{sv})"));
+	for (i = 0; i < contexts->len; i++)
+		add_object_entry (&builder, g_ptr_array_index (contexts, i));
+
+	mock_return ("ConnectionManager.GetContexts", "GetContexts", invocation,
+		     g_variant_new ("(@a(oa{sv}))", g_variant_builder_end (&builder)),
+		     NULL, NULL, NULL, NULL);
+
+	return TRUE;
+}
+
+static MockObject *
+mock_context_new (const gchar *type)
+{
+	MockObject *context;
+	gchar *path;
+
+	path = g_strdup_printf ("%s/context%u", modem_path, next_context++);
+	context = mock_object_new (connection_context_skeleton_new (), "ConnectionContext", path);
+	g_free (path);
+
+	mock_object_set (context, "Name", g_variant_new_string (!strcmp (type, "mms") ? "MMS" : "Internet"));
+	mock_object_set (context, "Type", g_variant_new_string (type));
+	mock_object_set (context, "Active", g_variant_new_boolean (FALSE));
+	mock_object_set (context, "AccessPointName", g_variant_new_string (""));
+	mock_object_set (context, "Username", g_variant_new_string (""));
+	mock_object_set (context, "Password", g_variant_new_string (""));
+	mock_object_set (context, "Protocol", g_variant_new_string ("ip"));
+
+	if (!strcmp (type, "mms")) {
+		mock_object_set (context, "MessageCenter", g_variant_new_string (""));
+		mock_object_set (context, "MessageProxy", g_variant_new_string (""));
+	}
+
+	g_signal_connect (context->skeleton, "handle-get-properties",
+			  G_CALLBACK (handle_get_properties), context);
+	g_signal_connect (context->skeleton, "handle-set-property",
+			  G_CALLBACK (handle_set_property), context);
+
+	g_ptr_array_add (contexts, context);
+
+	return context;
+}
+
+static gboolean
+handle_add_context (ConnectionManager     *object,
+		    GDBusMethodInvocation *invocation,
+		    const gchar           *type,
+		    gpointer               user_data)
+{
+	const gchar *error_name;
+	MockObject *context;
+
+	error_name = mock_fault ("ConnectionManager.AddContext", "AddContext", NULL);
+	if (error_name == NULL && strcmp (type, "internet") && strcmp (type, "mms") &&
+	    strcmp (type, "wap") && strcmp (type, "ims"))
+		error_name = OFONO_ERROR_PREFIX "InvalidArguments";
+
+	if (error_name) {
+		mock_return ("ConnectionManager.AddContext", "AddContext", invocation, NULL,
+			     error_name, NULL, NULL, NULL);
+		return TRUE;
+	}
+
+	context = mock_context_new (type);
+	mock_object_export (context);
+
+	mock_return ("ConnectionManager.AddContext", "AddContext", invocation,
+		     g_variant_new ("(o)", context->path), NULL, NULL, NULL, NULL);
+
+	return TRUE;
+}
+
+/**********************************************************/
+/* Timed events */
+/**********************************************************/
+
+static gboolean
+mock_hotplug (gpointer user_data)
+{
+	GVariant *interfaces;
+
+	if (modem == NULL)
+		return FALSE;
+
+	g_message ("Bringing up the SIM and data interfaces");
+
+	interfaces = g_variant_ref_sink (g_variant_new_strv (modem_interfaces, -1));
+	mock_object_set (modem, "Interfaces", interfaces);
+	mock_emit_property_changed (modem->path, mock_object_interface_name (modem),
+				    "Interfaces", interfaces);
+	g_variant_unref (interfaces);
+
+	return FALSE;
+}
+
+static gboolean
+mock_remove_modem (gpointer user_data)
+{
+	g_message ("Removing %s", modem_path);
+
+	manager_emit_modem_removed (MANAGER (manager->skeleton), modem_path);
+
+	g_ptr_array_set_size (contexts, 0);
+	g_clear_pointer (&connection_manager, mock_object_free);
+	g_clear_pointer (&sim_manager, mock_object_free);
+	g_clear_pointer (&modem, mock_object_free);
+
+	return FALSE;
+}
+
+/**********************************************************/
+/* Options */
+/**********************************************************/
+
+/* Method=MS */
+static gboolean
+parse_latencies (gchar **specs)
+{
+	gchar **spec;
+
+	for (spec = specs; spec && *spec; spec++) {
+		gchar *equals = strchr (*spec, '=');
+		gchar *end;
+		guint64 ms;
+
+		if (equals == NULL) {
+			g_printerr ("Expected Method=MS, got '%s'\n", *spec);
+			return FALSE;
+		}
+
+		ms = g_ascii_strtoull (equals + 1, &end, 10);
+		if (*end != '\0' || ms > G_MAXUINT) {
+			g_printerr ("Bad latency in '%s'\n", *spec);
+			return FALSE;
+		}
+
+		g_hash_table_insert (latencies, g_strndup (*spec, equals - *spec),
+				     GUINT_TO_POINTER ((guint) ms));
+	}
+
+	return TRUE;
+}
+
+static void
+mock_fault_free (MockFault *fault)
+{
+	g_free (fault->error_name);
+	g_slice_free (MockFault, fault);
+}
+
+/* Method[=Error][:count], Error defaults to Failed */
+static gboolean
+parse_faults (gchar **specs)
+{
+	gchar **spec;
+
+	for (spec = specs; spec && *spec; spec++) {
+		MockFault *fault;
+		gchar *key, *error_name, *colon, *equals;
+
+		key = g_strdup (*spec);
+		fault = g_slice_new0 (MockFault);
+		fault->remaining = -1;
+
+		colon = strchr (key, ':');
+		if (colon) {
+			*colon = '\0';
+			fault->remaining = atoi (colon + 1);
+			if (fault->remaining <= 0) {
+				g_printerr ("Bad count in '%s'\n", *spec);
+				mock_fault_free (fault);
+				g_free (key);
+				return FALSE;
+			}
+		}
+
+		equals = strchr (key, '=');
+		if (equals) {
+			*equals = '\0';
+			error_name = equals + 1;
+		} else
+			error_name = "Failed";
+
+		if (strchr (error_name, '.'))
+			fault->error_name = g_strdup (error_name);
+		else
+			fault->error_name = g_strconcat (OFONO_ERROR_PREFIX, error_name, NULL);
+
+		g_hash_table_insert (faults, key, fault);
+	}
+
+	return TRUE;
+}
+
+/**********************************************************/
+/* Setup */
+/**********************************************************/
+
+static void
+mock_setup_objects (const gchar *mcc, gboolean active, gboolean hotplug)
+{
+	MockObject *context;
+
+	manager = mock_object_new (manager_skeleton_new (), "Manager", "/");
+	g_signal_connect (manager->skeleton, "handle-get-modems",
+			  G_CALLBACK (handle_get_modems), NULL);
+
+	modem = mock_object_new (modem_skeleton_new (), "Modem", modem_path);
+	mock_object_set (modem, "Name", g_variant_new_string ("Mock Modem"));
+	mock_object_set (modem, "Manufacturer", g_variant_new_string ("oFono"));
+	mock_object_set (modem, "Model", g_variant_new_string ("Mock"));
+	mock_object_set (modem, "Type", g_variant_new_string ("hardware"));
+	mock_object_set (modem, "Powered", g_variant_new_boolean (TRUE));
+	mock_object_set (modem, "Online", g_variant_new_boolean (TRUE));
+	mock_object_set (modem, "Interfaces",
+			 g_variant_new_strv (hotplug ? no_interfaces : modem_interfaces, -1));
+	g_signal_connect (modem->skeleton, "handle-get-properties",
+			  G_CALLBACK (handle_get_properties), modem);
+	g_signal_connect (modem->skeleton, "handle-set-property",
+			  G_CALLBACK (handle_set_property), modem);
+
+	sim_manager = mock_object_new (sim_manager_skeleton_new (), "SimManager", modem_path);
+	mock_object_set (sim_manager, "Present", g_variant_new_boolean (TRUE));
+	mock_object_set (sim_manager, "MobileCountryCode", g_variant_new_string (mcc));
+	mock_object_set (sim_manager, "MobileNetworkCode", g_variant_new_string ("01"));
+	g_signal_connect (sim_manager->skeleton, "handle-get-properties",
+			  G_CALLBACK (handle_get_properties), sim_manager);
+
+	connection_manager = mock_object_new (connection_manager_skeleton_new (),
+					      "ConnectionManager", modem_path);
+	g_signal_connect (connection_manager->skeleton, "handle-get-contexts",
+			  G_CALLBACK (handle_get_contexts), NULL);
+	g_signal_connect (connection_manager->skeleton, "handle-add-context",
+			  G_CALLBACK (handle_add_context), NULL);
+
+	contexts = g_ptr_array_new_with_free_func ((GDestroyNotify) mock_object_free);
+
+	context = mock_context_new ("internet");
+	mock_object_set (context, "Active", g_variant_new_boolean (active));
+}
+
+static void
+on_bus_acquired (GDBusConnection *connection,
+		 const gchar     *name,
+		 gpointer         user_data)
+{
+	guint i;
+
+	bus = connection;
+
+	if (!mock_object_export (manager) ||
+	    !mock_object_export (modem) ||
+	    !mock_object_export (sim_manager) ||
+	    !mock_object_export (connection_manager)) {
+		g_main_loop_quit (loop);
+		return;
+	}
+
+	for (i = 0; i < contexts->len; i++) {
+		if (!mock_object_export (g_ptr_array_index (contexts, i))) {
+			g_main_loop_quit (loop);
+			return;
+		}
+	}
+}
+
+static void
+on_name_acquired (GDBusConnection *connection,
+		  const gchar     *name,
+		  gpointer         user_data)
+{
+	g_message ("Serving %s with modem %s", name, modem_path);
+}
+
+static void
+on_name_lost (GDBusConnection *connection,
+	      const gchar     *name,
+	      gpointer         user_data)
+{
+	g_warning ("Unable to own %s on the session bus", name);
+	g_main_loop_quit (loop);
+}
+
+gint
+main (gint argc, gchar **argv)
+{
+	GOptionContext *context;
+	GError *error = NULL;
+	gchar **latency_specs = NULL;
+	gchar **fault_specs = NULL;
+	gchar *mcc = NULL;
+	gboolean active = FALSE;
+	gint hotplug = -1;
+	gint remove_after = -1;
+	gint latency = 0;
+	guint owner_id;
+
+	GOptionEntry entries[] = {
+		{ "path", 'p', 0, G_OPTION_ARG_STRING, &modem_path, "Object path for the modem", "PATH" },
+		{ "mcc", 'm', 0, G_OPTION_ARG_STRING, &mcc, "Mobile country code of the SIM", "MCC" },
+		{ "active", 'a', 0, G_OPTION_ARG_NONE, &active, "Start with the internet context active", NULL },
+		{ "latency", 'l', 0, G_OPTION_ARG_INT, &latency, "Delay every reply by MS", "MS" },
+		{ "method-latency", 0, 0, G_OPTION_ARG_STRING_ARRAY, &latency_specs,
+		  "Delay replies to one method", "METHOD=MS" },
+		{ "fail", 'f', 0, G_OPTION_ARG_STRING_ARRAY, &fault_specs,
+		  "Answer a method with an oFono error", "METHOD[=ERROR][:COUNT]" },
+		{ "hotplug", 0, 0, G_OPTION_ARG_INT, &hotplug,
+		  "Expose the SIM and data interfaces only after MS", "MS" },
+		{ "remove-after", 0, 0, G_OPTION_ARG_INT, &remove_after,
+		  "Remove the modem after MS", "MS" },
+		{ NULL }
+	};
+
+#if !GLIB_CHECK_VERSION (2, 35, 0)
+	g_type_init ();
+#endif
+
+	latencies = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	faults = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+					(GDestroyNotify) mock_fault_free);
+
+	context = g_option_context_new ("- pretend to be oFono on the session bus");
+	g_option_context_add_main_entries (context, entries, NULL);
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("%s\n", error->message);
+		g_error_free (error);
+		return 1;
+	}
+	g_option_context_free (context);
+
+	if (latency < 0 || !parse_latencies (latency_specs) || !parse_faults (fault_specs))
+		return 1;
+
+	default_latency = latency;
+	g_strfreev (latency_specs);
+	g_strfreev (fault_specs);
+
+	if (modem_path == NULL)
+		modem_path = g_strdup ("/mock_0");
+
+	mock_setup_objects (mcc ? mcc : "234", active, hotplug >= 0);
+
+	loop = g_main_loop_new (NULL, FALSE);
+
+	owner_id = g_bus_own_name (G_BUS_TYPE_SESSION,
+				   OFONO_SERVICE,
+				   G_BUS_NAME_OWNER_FLAGS_NONE,
+				   on_bus_acquired,
+				   on_name_acquired,
+				   on_name_lost,
+				   NULL,
+				   NULL);
+
+	if (hotplug >= 0)
+		g_timeout_add (hotplug, mock_hotplug, NULL);
+
+	if (remove_after >= 0)
+		g_timeout_add (remove_after, mock_remove_modem, NULL);
+
+	g_main_loop_run (loop);
+
+	g_bus_unown_name (owner_id);
+	g_main_loop_unref (loop);
+
+	g_free (mcc);
+
+	return 0;
+}
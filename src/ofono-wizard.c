@@ -25,12 +25,12 @@
 #include <config.h>
 #endif
 #include <stdlib.h>
+#include <stdarg.h>
 
 #include <glib.h>
 #include <glib/gi18n.h>
 
 #include "ofono-manager.h"
-#include "ofono-modem.h"
 #include "ofono-connman.h"
 #include "ofono-context.h"
 #include "ofono-sim.h"
@@ -38,26 +38,103 @@
 #include "ofono-wizard.h"
 #include "mobile-provider.h"
 
+typedef struct {
+	OfonoWizard *wizard;
+	gchar *type;
+	gchar *path;
+	gboolean active;
+	ConnectionContext *proxy;
+	GVariant *properties;		/* a{sv} oFono reported, NULL until ready */
+	GVariant *settings;		/* a{sv} to apply */
+
+	/*
+	 * The proxy is made and the properties fetched while the user is
+	 * still in the assistant. ready is set once that is over, whether
+	 * it worked or not; an apply asked for before that is queued.
+	 */
+	gboolean ready;
+	gboolean apply_queued;
+
+	/* Settings in flight, and when we took the context down to send them */
+	guint writes;
+	gint64 down_since;
+} OfonoContext;
+
+typedef struct {
+	OfonoContext *context;
+	gchar *name;
+	GVariant *value;
+	GAsyncReadyCallback callback;
+	guint attempts;			/* retries so far */
+} ContextSetting;
+
 struct _OfonoWizardPrivate {
+	MobileProviderDatabase *db;
+	/*
+	 * Every proxy shares one connection. Once the Manager proxy knows
+	 * oFono's unique name the others are made for it directly, which
+	 * spares each a GetNameOwner call and a NameOwnerChanged match.
+	 */
+	GDBusConnection *connection;
+	gchar *ofono_name;
+	guint ofono_watch;		/* org.ofono owner, see ofono_vanished() */
 	Manager *manager;
-	Modem	*modem;
+	guint	modem_watch;		/* Modem.PropertyChanged subscription */
 	gchar	*name;
 	gchar	*mcc;
-	gchar	*context_path;
 	gchar	*modem_path;
 	ConnectionManager *ConnectionManager;
-	ConnectionContext *context;
 	SimManager *sim_manager;
-	gboolean active;
+	gboolean active;		/* of the internet context */
+
+	/* Context Type (key) <--> OfonoContext (value), first of each type */
+	GHashTable *contexts;
+
+	/* Calls in flight while applying the settings */
+	guint pending;
+
+	/* Bring a context we deactivated back up once it is written */
+	gboolean reactivate;
+
+	/* Shared by every pending oFono call, cancelled on ModemRemoved */
+	GCancellable *cancellable;
+
+	/*
+	 * Every call gets call_timeout ms. deadline ms bound each stretch
+	 * of talking to oFono, the probe and the apply, but not the time
+	 * spent waiting for the modem or the user. step says what we were
+	 * doing when the deadline hit.
+	 */
+	guint call_timeout;
+	guint deadline;
+	guint deadline_id;
+	const gchar *step;
+
+	/* Modem readiness, tracked through PropertyChanged */
+	gboolean has_sim_manager;
+	gboolean has_connection_manager;
+	gboolean sim_unavailable;
 
 	GtkWidget *assistant;
 	const gchar *country_by_mcc;
-	gchar *selected_country;
-	gchar *selected_provider;
-	gchar *selected_plan;
-	gchar *selected_apn;
-	gchar *selected_username;
-	gchar *selected_password;
+
+	/* Set while a thread warms the SIM country's lists, see prefetch_start() */
+	gboolean prefetching;
+
+	/*
+	 * The selection borrows from the database, or from the entries
+	 * while the user is typing. A typed provider or APN is copied to
+	 * unlisted_provider or unlisted_apn only once the assistant closes.
+	 * selected_plan is NULL for an unlisted plan.
+	 */
+	const gchar *selected_country;
+	const gchar *selected_provider;
+	const gchar *selected_plan;
+	const gchar *selected_apn;
+	const gchar *selected_username;
+	const gchar *selected_password;
+	gchar *unlisted_provider;
+	gchar *unlisted_apn;
 
 	/* Country page */
 	guint32 country_idx;
@@ -71,6 +148,7 @@ struct _OfonoWizardPrivate {
 	GtkWidget *providers_page;
 	GtkWidget *providers_view;
 	GtkListStore *providers_store;
+	const gchar *providers_country;	/* country providers_store was filled for */
 	guint32 providers_focus_id;
 	GtkWidget *providers_view_radio;
 
@@ -85,6 +163,8 @@ struct _OfonoWizardPrivate {
 	GtkWidget *plan_page;
 	GtkWidget *plan_combo;
 	GtkListStore *plan_store;
+	gboolean plans_listed;
+	const gchar * const *listed_plans;	/* plans plan_store was filled with */
 	guint32 plan_focus_id;
 
 	GtkWidget *plan_unlisted_entry;
@@ -100,6 +180,10 @@ struct _OfonoWizardPrivate {
 	guint32 confirm_idx;
 };
 
+/* Well below the 25 s D-Bus default, oFono answers in milliseconds */
+#define OFONO_WIZARD_CALL_TIMEOUT 5000
+#define OFONO_WIZARD_DEADLINE 30000
+
 #define OFONO_WIZARD_GET_PRIVATE(object) \
         (G_TYPE_INSTANCE_GET_PRIVATE ((object), OFONO_TYPE_WIZARD, OfonoWizardPrivate))
 
@@ -113,9 +197,28 @@ G_DEFINE_TYPE (OfonoWizard, ofono_wizard, G_TYPE_OBJECT)
 static void
 ofono_wizard_get_sim_manager (OfonoWizard *ofono_wizard);
 static void
-ofono_wizard_setup_context (OfonoWizard *ofono_wizard, gchar *apn, gchar *username, gchar *password);
+ofono_wizard_set_call_timeout (OfonoWizard *ofono_wizard, gpointer proxy);
 static void
-connection_context_set_apn (GObject *source_object, GAsyncResult *res, gpointer user_data);
+ofono_wizard_release_modem (OfonoWizard *ofono_wizard);
+static void
+ofono_vanished (GDBusConnection *connection, const gchar *name, gpointer user_data);
+static gpointer
+ofono_wizard_proxy_new (OfonoWizard        *ofono_wizard,
+			GType               type,
+			GDBusInterfaceInfo *info,
+			const gchar        *path,
+			gboolean            signals,
+			GError            **error);
+static void
+ofono_wizard_advance (OfonoWizard *ofono_wizard);
+static void
+ofono_wizard_apply_contexts (OfonoWizard *ofono_wizard);
+static OfonoContext *
+ofono_context_new (OfonoWizard *ofono_wizard, const gchar *type, const gchar *path);
+static void
+ofono_context_free (gpointer data);
+static void
+ofono_context_connect (OfonoContext *context);
 
 /**********************************************************/
 /* Confirm page */
@@ -221,7 +324,7 @@ confirm_prepare (OfonoWizardPrivate *priv)
 	gtk_widget_show (priv->confirm_plan);
 	gtk_widget_show (priv->confirm_apn);
 
-	if (strcmp (priv->selected_plan, _("My plan is not listed...")))
+	if (priv->selected_plan)
 		gtk_label_set_text (GTK_LABEL (priv->confirm_plan), priv->selected_plan);
 	else
 		gtk_label_set_text (GTK_LABEL (priv->confirm_plan), _("Unlisted"));
@@ -304,9 +407,22 @@ assistant_closed (GtkButton *button, gpointer user_data)
 
 	gtk_widget_hide (priv->assistant);
 
+	/* Typed text belongs to the entries, which go away with the assistant */
+	if (!gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (priv->providers_view_radio)) &&
+	    priv->selected_provider) {
+		priv->unlisted_provider = g_strdup (priv->selected_provider);
+		priv->selected_provider = priv->unlisted_provider;
+	}
+
+	if (priv->selected_plan == NULL && priv->selected_apn) {
+		priv->unlisted_apn = g_strdup (priv->selected_apn);
+		priv->selected_apn = priv->unlisted_apn;
+	}
+
 	gtk_widget_destroy (priv->assistant);
+	priv->assistant = NULL;
 
-	ofono_wizard_setup_context (wizard, priv->selected_apn, priv->selected_username, priv->selected_password);
+	ofono_wizard_apply_contexts (wizard);
 }
 
 /**********************************************************/
@@ -315,14 +431,16 @@ assistant_closed (GtkButton *button, gpointer user_data)
 
 #define PLAN_COL_NAME 0
 #define PLAN_COL_MANUAL 1
+#define PLAN_COL_KEY 2
 
-static PlanInfo *
+static const PlanInfo *
 get_selected_plan_info (OfonoWizardPrivate *priv)
 {
 	GtkTreeModel *model;
 	GtkTreeIter iter;
-	gchar *plan;
-	PlanInfo *info;
+	const gchar *plan = NULL;
+
+	priv->selected_plan = NULL;
 
 	if (!gtk_combo_box_get_active_iter (GTK_COMBO_BOX (priv->plan_combo), &iter))
 		return NULL;
@@ -331,35 +449,34 @@ get_selected_plan_info (OfonoWizardPrivate *priv)
 	if (!model)
 		return NULL;
 
+	/* The key column borrows the database's string, no copy */
 	gtk_tree_model_get (model, &iter,
-	                    PLAN_COL_NAME, &plan,
+	                    PLAN_COL_KEY, &plan,
 	                    -1);
+	if (plan == NULL)
+		return NULL;
 
 	priv->selected_plan = plan;
-	info = mobile_provider_get_plan_info (priv->selected_country, priv->selected_provider, plan);
 
-	return info;
+	return mobile_provider_database_get_plan_info (priv->db, priv->selected_country, priv->selected_provider, plan);
 }
 
 static void
 plan_update_complete (OfonoWizardPrivate *priv)
 {
 	GtkAssistant *assistant = GTK_ASSISTANT (priv->assistant);
-	PlanInfo *info;
+	const PlanInfo *info;
 
 	info = get_selected_plan_info (priv);
 	if (info) {
 		priv->selected_apn = info->apn;
 
-		if (info->username)
-			priv->selected_username = info->username;
-
-		if (info->password)
-			priv->selected_password = info->password;
+		priv->selected_username = info->username;
+		priv->selected_password = info->password;
 
 		gtk_assistant_set_page_complete (assistant, priv->plan_page, TRUE);
 	} else {
-		priv->selected_apn = g_strdup (gtk_entry_get_text (GTK_ENTRY (priv->plan_unlisted_entry)));
+		priv->selected_apn = gtk_entry_get_text (GTK_ENTRY (priv->plan_unlisted_entry));
 		priv->selected_username = NULL;
 		priv->selected_password = NULL;
 
@@ -376,7 +493,7 @@ plan_update_complete (OfonoWizardPrivate *priv)
 static void
 plan_combo_changed (OfonoWizardPrivate *priv)
 {
-	PlanInfo *info;
+	const PlanInfo *info;
 
 	info = get_selected_plan_info (priv);
 	if (info) {
@@ -452,7 +569,7 @@ plan_setup (OfonoWizardPrivate *priv)
 	gtk_misc_set_alignment (GTK_MISC (label), 0, 0.5);
 	gtk_box_pack_start (GTK_BOX (vbox), label, FALSE, FALSE, 0);
 
-	priv->plan_store = gtk_list_store_new (2, G_TYPE_STRING, G_TYPE_BOOLEAN);
+	priv->plan_store = gtk_list_store_new (3, G_TYPE_STRING, G_TYPE_BOOLEAN, G_TYPE_POINTER);
 
 	priv->plan_combo = gtk_combo_box_new_with_model (GTK_TREE_MODEL (priv->plan_store));
 	gtk_label_set_mnemonic_widget (GTK_LABEL (label), priv->plan_combo);
@@ -494,7 +611,11 @@ plan_setup (OfonoWizardPrivate *priv)
 		gtk_misc_set_alignment (GTK_MISC (image), 0.5, 0.0);
 		gtk_box_pack_start (GTK_BOX (hbox), image, FALSE, FALSE, 0);
 
-		label = gtk_label_new (_("Warning: You seem to have a active data connection.\nApplying these new settings will disconnect you from the active data connection.\n\n"));
+		/* With --reactivate the connection only drops while the settings are written */
+		if (priv->reactivate)
+			label = gtk_label_new (_("Warning: You seem to have a active data connection.\nApplying these new settings will briefly interrupt the active data connection, it is brought back up right after.\n\n"));
+		else
+			label = gtk_label_new (_("Warning: You seem to have a active data connection.\nApplying these new settings will disconnect you from the active data connection.\n\n"));
 		gtk_widget_set_size_request (label, 500, -1);
 		gtk_label_set_line_wrap (GTK_LABEL (label), TRUE);
 		gtk_box_pack_start (GTK_BOX (hbox), label, FALSE, TRUE, 0);
@@ -526,6 +647,8 @@ add_plan (gpointer data, gpointer user_data)
 	                    plan,
 	                    PLAN_COL_MANUAL,
 	                    TRUE,
+	                    PLAN_COL_KEY,
+	                    plan,
 	                    -1);
 }
 
@@ -533,17 +656,26 @@ static void
 plan_prepare (OfonoWizardPrivate *priv)
 {
 	GtkTreeIter method_iter;
-	GList *plans;
+	const gchar * const *plans, * const *plan;
+
+	plans = mobile_provider_database_get_plans (priv->db, priv->selected_country, priv->selected_provider);
+
+	/* Coming back to the same provider keeps the list and what was typed */
+	if (priv->plans_listed && plans == priv->listed_plans) {
+		plan_update_complete (priv);
+		return;
+	}
 
-	if (priv->plan_store)
-		gtk_list_store_clear (priv->plan_store);
+	priv->plans_listed = TRUE;
+	priv->listed_plans = plans;
 
-	plans = mobile_provider_get_plan_list (priv->selected_country, priv->selected_provider);
-	if (plans)
-		g_list_foreach (plans, add_plan, priv);
+	gtk_list_store_clear (priv->plan_store);
+
+	for (plan = plans; plan && *plan; plan++)
+		add_plan ((gpointer) *plan, priv);
 
 	/* Draw the separator */
-	if (plans)
+	if (plans && *plans)
 		gtk_list_store_append (GTK_LIST_STORE (priv->plan_store), &method_iter);
 
 	/* Add the "My plan is not listed..." item */
@@ -568,14 +700,15 @@ plan_prepare (OfonoWizardPrivate *priv)
 /**********************************************************/
 
 #define PROVIDER_COL_NAME 0
+#define PROVIDER_COL_KEY 1
 
-static gchar *
+static const gchar *
 get_selected_provider (OfonoWizardPrivate *priv)
 {
 	GtkTreeSelection *selection;
 	GtkTreeModel *model = NULL;
 	GtkTreeIter iter;
-	gchar *provider = NULL;
+	const gchar *provider = NULL;
 
 	if (!gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (priv->providers_view_radio)))
 		return NULL;
@@ -586,7 +719,7 @@ get_selected_provider (OfonoWizardPrivate *priv)
 	if (!gtk_tree_selection_get_selected (GTK_TREE_SELECTION (selection), &model, &iter))
 		return NULL;
 
-	gtk_tree_model_get (model, &iter, PROVIDER_COL_NAME, &provider, -1);
+	gtk_tree_model_get (model, &iter, PROVIDER_COL_KEY, &provider, -1);
 	return provider;
 }
 
@@ -605,7 +738,7 @@ providers_update_complete (OfonoWizardPrivate *priv)
 
 		gtk_assistant_set_page_complete (assistant, priv->providers_page, complete);
 	} else {
-		priv->selected_provider = (gchar *) gtk_entry_get_text (GTK_ENTRY (priv->provider_unlisted_entry));
+		priv->selected_provider = gtk_entry_get_text (GTK_ENTRY (priv->provider_unlisted_entry));
 		gtk_assistant_set_page_complete (assistant, priv->providers_page,
 		                                 (priv->selected_provider && strlen (priv->selected_provider)));
 	}
@@ -662,19 +795,16 @@ providers_search_func (GtkTreeModel *model,
                        GtkTreeIter *iter,
                        gpointer search_data)
 {
-	gboolean unmatched = TRUE;
-	char *provider = NULL;
+	const char *provider = NULL;
 
 	if (!key)
 		return TRUE;
 
-	gtk_tree_model_get (model, iter, column, &provider, -1);
+	gtk_tree_model_get (model, iter, PROVIDER_COL_KEY, &provider, -1);
 	if (!provider)
 		return TRUE;
 
-	unmatched = !!g_ascii_strncasecmp (provider, key, strlen (key));
-	g_free (provider);
-	return unmatched;
+	return !!g_ascii_strncasecmp (provider, key, strlen (key));
 }
 
 
@@ -693,6 +823,8 @@ add_provider (gpointer data, gpointer user_data)
 	                    &provider_iter,
 	                    PROVIDER_COL_NAME,
 	                    provider,
+	                    PROVIDER_COL_KEY,
+	                    provider,
 	                    -1);
 }
 
@@ -712,7 +844,7 @@ providers_setup (OfonoWizardPrivate *priv)
 	g_signal_connect (priv->providers_view_radio, "toggled", G_CALLBACK (providers_radio_toggled), priv);
 	gtk_box_pack_start (GTK_BOX (vbox), priv->providers_view_radio, FALSE, TRUE, 0);
 
-	priv->providers_store = gtk_list_store_new (1, G_TYPE_STRING);
+	priv->providers_store = gtk_list_store_new (2, G_TYPE_STRING, G_TYPE_POINTER);
 
 	priv->providers_view = gtk_tree_view_new_with_model (GTK_TREE_MODEL (priv->providers_store));
 
@@ -794,25 +926,26 @@ providers_setup (OfonoWizardPrivate *priv)
 }
 
 static void
-providers_prepare (OfonoWizardPrivate *priv)
+providers_fill (OfonoWizardPrivate *priv, const gchar *country)
 {
 	GtkTreeSelection *selection;
-	GList *providers;
+	const gchar * const *provider;
 
+	priv->providers_country = country;
 	gtk_list_store_clear (priv->providers_store);
 
-	if (!strcmp (priv->selected_country, _("Not Listed"))) {
+	if (!strcmp (country, _("Not Listed"))) {
 		/* Unlisted country */
 		gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (priv->provider_unlisted_radio), TRUE);
 		gtk_widget_set_sensitive (GTK_WIDGET (priv->providers_view_radio), FALSE);
-		goto done;
+		return;
 	}
 
 	gtk_widget_set_sensitive (GTK_WIDGET (priv->providers_view_radio), TRUE);
 
-	providers = mobile_provider_get_provider_list (priv->selected_country);
-	if (providers)
-		g_list_foreach (providers, add_provider, priv);
+	provider = mobile_provider_database_get_providers (priv->db, country);
+	for (; provider && *provider; provider++)
+		add_provider ((gpointer) *provider, priv);
 
 
 	g_object_set (G_OBJECT (priv->providers_view), "enable-search", TRUE, NULL);
@@ -838,8 +971,15 @@ providers_prepare (OfonoWizardPrivate *priv)
 			}
 		}
 	}
+}
+
+static void
+providers_prepare (OfonoWizardPrivate *priv)
+{
+	/* Coming back to the same country keeps the list and the selection */
+	if (priv->selected_country != priv->providers_country)
+		providers_fill (priv, priv->selected_country);
 
-done:
 	providers_radio_toggled (NULL, priv);
 
 	/* Initial completeness state */
@@ -857,6 +997,7 @@ done:
 /**********************************************************/
 
 #define COUNTRIES_COL_NAME 0
+#define COUNTRIES_COL_KEY 1
 
 static gboolean
 country_search_func (GtkTreeModel *model,
@@ -865,19 +1006,16 @@ country_search_func (GtkTreeModel *model,
                      GtkTreeIter *iter,
                      gpointer search_data)
 {
-	gboolean unmatched = TRUE;
-	char *country = NULL;
+	const char *country = NULL;
 
 	if (!key)
 		return TRUE;
 
-	gtk_tree_model_get (model, iter, column, &country, -1);
+	gtk_tree_model_get (model, iter, COUNTRIES_COL_KEY, &country, -1);
 	if (!country)
 		return TRUE;
 
-	unmatched = !!g_ascii_strncasecmp (country, key, strlen (key));
-	g_free (country);
-	return unmatched;
+	return !!g_ascii_strncasecmp (country, key, strlen (key));
 }
 
 static void
@@ -896,6 +1034,8 @@ add_country (gpointer data, gpointer user_data)
 	                    &country_iter,
 	                    COUNTRIES_COL_NAME,
 	                    country,
+	                    COUNTRIES_COL_KEY,
+	                    country,
 	                    -1);
 
 	/* If this country is the same country as the user's current locale,
@@ -923,13 +1063,13 @@ add_country (gpointer data, gpointer user_data)
 	gtk_tree_path_free (country_path);
 }
 
-static gchar *
+static const gchar *
 get_selected_country (OfonoWizardPrivate *priv)
 {
 	GtkTreeSelection *selection;
 	GtkTreeModel *model = NULL;
 	GtkTreeIter iter;
-	gchar *country = NULL;
+	const gchar *country = NULL;
 
 	selection = gtk_tree_view_get_selection (GTK_TREE_VIEW (priv->country_view));
 	g_assert (selection);
@@ -937,10 +1077,11 @@ get_selected_country (OfonoWizardPrivate *priv)
 	if (!gtk_tree_selection_get_selected (GTK_TREE_SELECTION (selection), &model, &iter))
 		return NULL;
 
-	gtk_tree_model_get (model, &iter, COUNTRIES_COL_NAME, &country, -1);
+	gtk_tree_model_get (model, &iter, COUNTRIES_COL_KEY, &country, -1);
 
-	if (!strcmp (country, _("My country is not listed")))
-		country = g_strdup (_("Not Listed"));
+	/* Only "My country is not listed" has no key */
+	if (country == NULL)
+		country = _("Not Listed");
 
 	return country;
 }
@@ -967,7 +1108,7 @@ country_setup (OfonoWizardPrivate *priv)
 	GtkTreeViewColumn *column;
 	GtkTreeSelection *selection;
 	GtkTreeIter unlisted_iter;
-	GList *countries;
+	const gchar * const *country;
 
         vbox = gtk_box_new (GTK_ORIENTATION_VERTICAL, 6);
 	gtk_container_set_border_width (GTK_CONTAINER (vbox), 12);
@@ -975,7 +1116,7 @@ country_setup (OfonoWizardPrivate *priv)
 	gtk_misc_set_alignment (GTK_MISC (label), 0, 0.5);
 	gtk_box_pack_start (GTK_BOX (vbox), label, FALSE, TRUE, 0);
 
-	priv->country_store = gtk_list_store_new (1, G_TYPE_STRING);
+	priv->country_store = gtk_list_store_new (2, G_TYPE_STRING, G_TYPE_POINTER);
 
 	priv->country_view = gtk_tree_view_new_with_model (GTK_TREE_MODEL (priv->country_store));
 
@@ -988,9 +1129,9 @@ country_setup (OfonoWizardPrivate *priv)
 	gtk_tree_view_column_set_clickable (column, TRUE);
 
 	/* Add the Countries */
-	countries = mobile_provider_get_country_list ();
-	if (countries)
-		g_list_foreach (countries, add_country, priv);
+	country = mobile_provider_database_get_countries (priv->db);
+	for (; country && *country; country++)
+		add_country ((gpointer) *country, priv);
 
 	/* My country is not listed... */
 	gtk_list_store_append (GTK_LIST_STORE (priv->country_store), &unlisted_iter);
@@ -1066,6 +1207,79 @@ country_prepare (OfonoWizardPrivate *priv)
 	country_update_complete (priv);
 }
 
+/**********************************************************/
+/* Prefetch */
+/**********************************************************/
+
+typedef struct {
+	OfonoWizard *wizard;
+	MobileProviderDatabase *db;
+	const gchar *country;
+} Prefetch;
+
+/* Back on the main loop, list the providers unless the user beat us to it */
+static gboolean
+prefetch_done (gpointer user_data)
+{
+	Prefetch *prefetch = user_data;
+	OfonoWizardPrivate *priv = prefetch->wizard->priv;
+
+	priv->prefetching = FALSE;
+	if (priv->assistant && priv->providers_country == NULL)
+		providers_fill (priv, prefetch->country);
+
+	mobile_provider_database_unref (prefetch->db);
+	g_object_unref (prefetch->wizard);
+	g_slice_free (Prefetch, prefetch);
+
+	return FALSE;
+}
+
+/* The database caches what it returns, asking is all it takes */
+static gpointer
+prefetch_thread (gpointer user_data)
+{
+	Prefetch *prefetch = user_data;
+	const gchar * const *provider;
+
+	provider = mobile_provider_database_get_providers (prefetch->db, prefetch->country);
+	for (; provider && *provider; provider++)
+		mobile_provider_database_get_plans (prefetch->db, prefetch->country, *provider);
+
+	g_idle_add_full (G_PRIORITY_LOW, prefetch_done, prefetch, NULL);
+
+	return NULL;
+}
+
+/*
+ * Most users stay in the SIM's country, so its providers and their plans
+ * are fetched while the intro page is read. With the provider service
+ * those are D-Bus round trips the pages would otherwise wait on.
+ */
+static void
+prefetch_start (OfonoWizard *ofono_wizard)
+{
+	OfonoWizardPrivate *priv = ofono_wizard->priv;
+	Prefetch *prefetch;
+	GThread *thread;
+
+	if (priv->country_by_mcc == NULL || priv->prefetching)
+		return;
+
+	/* A database parsed here is all in memory, there's nothing to warm */
+	if (!mobile_provider_database_uses_service (priv->db))
+		return;
+
+	prefetch = g_slice_new (Prefetch);
+	prefetch->wizard = g_object_ref (ofono_wizard);
+	prefetch->db = mobile_provider_database_ref (priv->db);
+	prefetch->country = priv->country_by_mcc;
+
+	priv->prefetching = TRUE;
+	thread = g_thread_new ("prefetch", prefetch_thread, prefetch);
+	g_thread_unref (thread);
+}
+
 static void
 assistant_cancel (GtkButton *button, gpointer user_data)
 {
@@ -1113,17 +1327,12 @@ void
 ofono_wizard_setup_assistant(OfonoWizard *ofono_wizard)
 {
 	OfonoWizardPrivate *priv;
-	gchar *country_code_by_mcc = NULL;
 
 	priv = OFONO_WIZARD_GET_PRIVATE (ofono_wizard);
 
 	priv->assistant = gtk_assistant_new ();
 
-	if (priv->mcc)
-		country_code_by_mcc = mobile_provider_get_country_code_from_mcc (priv->mcc);
-
-	if (country_code_by_mcc)
-		priv->country_by_mcc = mobile_provider_get_country_from_code (country_code_by_mcc);
+	priv->country_by_mcc = mobile_provider_database_get_country_from_mcc (priv->db, priv->mcc);
 
 	gtk_window_set_title (GTK_WINDOW (priv->assistant), _("Mobile Broadband Connection Setup"));
 	gtk_window_set_position (GTK_WINDOW (priv->assistant), GTK_WIN_POS_CENTER_ALWAYS);
@@ -1139,29 +1348,23 @@ ofono_wizard_setup_assistant(OfonoWizard *ofono_wizard)
 	g_signal_connect (priv->assistant, "prepare", G_CALLBACK (assistant_prepare), priv);
 
 	gtk_window_present (GTK_WINDOW (priv->assistant));
+
+	prefetch_start (ofono_wizard);
 }
 
 static void
 ofono_wizard_init (OfonoWizard *ofono_wizard)
 {
-	GError *error = NULL;
 	OfonoWizardPrivate *priv;
 
 	ofono_wizard->priv = OFONO_WIZARD_GET_PRIVATE (ofono_wizard);
 	priv = ofono_wizard->priv;
 
-	priv->manager = manager_proxy_new_for_bus_sync (G_BUS_TYPE_SYSTEM,
-							G_DBUS_PROXY_FLAGS_NONE,
-							"org.ofono",
-							"/",
-							NULL,
-							&error);
-
-	if (priv->manager == NULL) {
-		g_warning ("Unable to get oFono proxy:%s", error->message);
-		g_error_free (error);
-		exit (0);
-	}
+	priv->cancellable = g_cancellable_new ();
+	priv->call_timeout = OFONO_WIZARD_CALL_TIMEOUT;
+	priv->deadline = OFONO_WIZARD_DEADLINE;
+	priv->contexts = g_hash_table_new_full (g_str_hash, g_str_equal,
+						NULL, ofono_context_free);
 }
 
 static void
@@ -1179,420 +1382,1232 @@ ofono_wizard_finalize (GObject *object)
 {
 
 	OfonoWizard *ofono_wizard = OFONO_WIZARD (object);
+	OfonoWizardPrivate *priv = ofono_wizard->priv;
+
+	/* Cancels whatever is in flight and drops the modem's proxies */
+	ofono_wizard_release_modem (ofono_wizard);
+
+	remove_provider_focus_idle (priv);
+	remove_country_focus_idle (priv);
+
+	if (priv->assistant)
+		gtk_widget_destroy (priv->assistant);
+	g_clear_object (&priv->country_store);
+	g_clear_object (&priv->providers_store);
+	g_clear_object (&priv->plan_store);
+
+	if (priv->manager)
+		g_signal_handlers_disconnect_by_data (priv->manager, ofono_wizard);
+	g_clear_object (&priv->manager);
+	if (priv->ofono_watch)
+		g_bus_unwatch_name (priv->ofono_watch);
+	g_clear_object (&priv->connection);
+	g_clear_object (&priv->cancellable);
+
+	g_free (priv->ofono_name);
+	g_free (priv->modem_path);
+	g_free (priv->name);
+	g_free (priv->mcc);
+	g_free (priv->unlisted_provider);
+	g_free (priv->unlisted_apn);
+	g_hash_table_destroy (priv->contexts);
+
+	mobile_provider_database_unref (priv->db);
 
 	if (G_OBJECT_CLASS (ofono_wizard_parent_class)->finalize)
 		(* G_OBJECT_CLASS (ofono_wizard_parent_class)->finalize) (object);
 }
 
 OfonoWizard *
-ofono_wizard_new (void)
-{
-	return g_object_new (OFONO_TYPE_WIZARD, NULL);
-}
-
-/**********************************************************/
-/* oFono functions */
-/**********************************************************/
-static void
-connection_manager_get_contexts_cb (GObject      *source_object,
-				    GAsyncResult *res,
-				    gpointer      user_data)
+ofono_wizard_new (MobileProviderDatabase *db, GBusType bus_type)
 {
+	OfonoWizard *ofono_wizard;
+	OfonoWizardPrivate *priv;
 	GError *error = NULL;
-	GVariant *value = NULL;
-	gboolean ret, found = FALSE;
-	GVariant *result, *array_value, *tuple_value, *properties;
-	GVariantIter array_iter, tuple_iter;
-	gchar *path, *type;
 
-	OfonoWizard *wizard = user_data;
-	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (wizard);
+	ofono_wizard = g_object_new (OFONO_TYPE_WIZARD, NULL);
+	priv = ofono_wizard->priv;
 
-	ret = connection_manager_call_get_contexts_finish (priv->ConnectionManager, &result, res, &error);
-	if (!ret) {
-		g_warning ("Unable to get Modem Proxy: %s", error->message);
+	priv->db = mobile_provider_database_ref (db);
+
+	priv->connection = g_bus_get_sync (bus_type, priv->cancellable, &error);
+	if (priv->connection == NULL) {
+		g_warning ("Unable to connect to the bus: %s", error->message);
 		g_error_free (error);
 		exit (0);
 	}
 
-	/* Result is  (a(oa{sv}))*/
-	g_variant_iter_init (&array_iter, result);
-
-	while ((array_value = g_variant_iter_next_value (&array_iter)) != NULL) {
-		/* tuple_iter is oa{sv} */
-		g_variant_iter_init (&tuple_iter, array_value);
-
-		/* get the object path */
-		tuple_value = g_variant_iter_next_value (&tuple_iter);
-		g_variant_get (tuple_value, "o", &path);
-
-		/* get the Properties */
-		properties = g_variant_iter_next_value (&tuple_iter);
-		g_variant_lookup (properties, "Type", "s", &type);
-		if (!strcmp (type, "internet")) {
-			/* Found the 1st internet context */
-			priv->context_path = g_strdup (path);
-			ret = g_variant_lookup (properties, "Active", "b", &priv->active);
-			/* Check if the context if active */
-			if (!ret)
-				priv->active = TRUE;
-
-			found = TRUE;
-			break;
-		}
-
-		g_variant_unref (array_value);
-		g_variant_unref (tuple_value);
-		g_variant_unref (properties);
-	}
-
-	if (!found) {
-		g_warning ("Unable to get Internet context");
+	/* ModemRemoved is the one signal we want from it */
+	priv->manager = ofono_wizard_proxy_new (ofono_wizard, TYPE_MANAGER_PROXY,
+						manager_interface_info (), "/",
+						TRUE, &error);
+	if (priv->manager == NULL) {
+		g_warning ("Unable to get oFono proxy:%s", error->message);
+		g_error_free (error);
 		exit (0);
-		/* Create a 'internet' context here? */
 	}
 
-	g_variant_unref (array_value);
-	g_variant_unref (tuple_value);
-	g_variant_unref (properties);
-	g_variant_unref (result);
+	priv->ofono_name = g_dbus_proxy_get_name_owner (G_DBUS_PROXY (priv->manager));
 
-	ofono_wizard_setup_assistant (wizard);
+	/*
+	 * The other proxies are bound to that unique name. If oFono
+	 * restarts they talk to nobody, and no ModemRemoved ever comes.
+	 */
+	priv->ofono_watch = g_bus_watch_name_on_connection (priv->connection, "org.ofono",
+							     G_BUS_NAME_WATCHER_FLAGS_NONE,
+							     NULL, ofono_vanished,
+							     ofono_wizard, NULL);
+
+	return ofono_wizard;
 }
 
-static void
-ofono_wizard_get_modem_context (OfonoWizard *ofono_wizard)
+/* Negative values keep the defaults, a zero deadline disables it */
+void
+ofono_wizard_set_timeouts (OfonoWizard *ofono_wizard, gint call_timeout, gint deadline)
 {
-	GError *error = NULL;
-
 	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (ofono_wizard);
-	
-	priv->ConnectionManager = connection_manager_proxy_new_for_bus_sync (G_BUS_TYPE_SYSTEM,
-									     G_DBUS_PROXY_FLAGS_NONE,
-									     "org.ofono",
-									     priv->modem_path,
-									     NULL,
-									     &error);
 
-	if (priv->ConnectionManager == NULL) {
-		g_warning ("Unable to get Modem connection Manager: %s", error->message);
-		g_error_free (error);
-		exit (0);
-	}
+	if (call_timeout > 0)
+		priv->call_timeout = call_timeout;
+	if (deadline >= 0)
+		priv->deadline = deadline;
 
-	connection_manager_call_get_contexts (priv->ConnectionManager, NULL, connection_manager_get_contexts_cb ,ofono_wizard);
+	ofono_wizard_set_call_timeout (ofono_wizard, priv->manager);
 }
 
-static void
-modem_get_properties_cb (GObject      *source_object,
-			 GAsyncResult *res,
-			 gpointer      user_data)
+void
+ofono_wizard_set_reactivate (OfonoWizard *ofono_wizard, gboolean reactivate)
 {
-	GError *error = NULL;
-	GVariant *result = NULL;
-	GVariant *value = NULL;
-	gboolean ret;
-	const gchar *name, *manufacturer, *model, *type;
-	gchar *interface_list;
-	gchar **interfaces;
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (ofono_wizard);
 
-	OfonoWizard *wizard = user_data;
-	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (wizard);
+	priv->reactivate = reactivate;
+}
 
-	ret = modem_call_get_properties_finish (priv->modem, &result, res, &error);
-	if (!ret) {
-		g_warning ("Unable to get Modem Proxy: %s", error->message);
-		g_error_free (error);
-		exit (0);
-	}
+/**********************************************************/
+/* oFono functions */
+/**********************************************************/
 
-	/* Test for Type=Hardware here */
-	ret = g_variant_lookup (result, "Type", "s", &type);
-	if (!ret) {
-		g_warning ("Unable to determine modem type");
-		g_variant_unref (result);
-		exit (0);
-	}
+/* Swallow errors caused by our own teardown */
+static gboolean
+call_cancelled (GError *error)
+{
+	if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+		return FALSE;
 
-	if (strcmp (type, "hardware")) {
-		g_warning ("Not a real hardware modem");
-		g_variant_unref (result);
-		exit (0);
-	}
+	g_error_free (error);
+	return TRUE;
+}
 
-	ret = g_variant_lookup (result, "Name", "s", &name);
-	if (!ret) {
-		g_variant_lookup (result, "Manufacturer", "s", &manufacturer);
-		g_variant_lookup (result, "Model", "s", &model);
+/* Report a failed call, naming the step it was part of */
+static void
+ofono_wizard_call_failed (OfonoWizard  *ofono_wizard,
+			  const GError *error,
+			  const gchar  *format,
+			  ...)
+{
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (ofono_wizard);
+	va_list args;
+	gchar *step;
 
-		if (manufacturer && model)
-			priv->name = g_strdup_printf ("%s-%s", manufacturer, model);
-		else if (manufacturer)
-			priv->name = g_strdup (manufacturer);
-		else
-			priv->name = g_strdup ("Modem");
-	} else
-		priv->name = g_strdup (name);
+	va_start (args, format);
+	step = g_strdup_vprintf (format, args);
+	va_end (args);
 
-	ret = g_variant_lookup (result, "Interfaces", "^as", &interfaces);
-	if (!ret) {
-		g_warning ("Unable to get modem interfaces");
-		g_variant_unref (result);
-		exit (0);
-	}
+	if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT))
+		g_warning ("Timed out %s after %u ms", step, priv->call_timeout);
+	else
+		g_warning ("Failed %s: %s", step, error->message);
 
-	if (g_strv_length (interfaces) == 0) {
-		g_warning ("No modem interfaces found");
-		g_variant_unref (result);
-		exit (0);
-	}
+	g_free (step);
+}
 
-	/* Find if ConnectionManager interface is available */
-	interface_list = g_strjoinv (" ", interfaces);
-	gchar *s = g_strrstr (interface_list, "org.ofono.SimManager");
-	if (s == NULL) {
-		g_warning ("No SIM interface found");
-		g_free (interface_list);
-		g_strfreev (interfaces);
-		g_variant_unref (result);
-		exit (0);
-	}
+static void
+ofono_wizard_set_call_timeout (OfonoWizard *ofono_wizard, gpointer proxy)
+{
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (ofono_wizard);
 
-	gchar *c = g_strrstr (interface_list, "org.ofono.ConnectionManager");
-	if (c == NULL) {
-		g_warning ("No Contexts interface found");
-		g_free (interface_list);
-		g_strfreev (interfaces);
-		g_variant_unref (result);
-		exit (0);
-	}
+	g_dbus_proxy_set_default_timeout (G_DBUS_PROXY (proxy), priv->call_timeout);
+}
 
-	g_free (interface_list);
-	g_strfreev (interfaces);
-	g_variant_unref (result);
+/*
+ * Properties are always fetched with GetProperties, so no proxy loads
+ * them. Only proxies whose signals we handle add a match rule for them.
+ */
+static GDBusProxyFlags
+ofono_wizard_proxy_flags (gboolean signals)
+{
+	GDBusProxyFlags flags = G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES;
 
-	if (s)
-		ofono_wizard_get_sim_manager (wizard);
-	else
-		ofono_wizard_get_modem_context (wizard);
+	if (!signals)
+		flags |= G_DBUS_PROXY_FLAGS_DO_NOT_CONNECT_SIGNALS;
+
+	return flags;
 }
 
-void
-ofono_wizard_setup_modem (OfonoWizard *ofono_wizard, gchar *modem_path)
+static const gchar *
+ofono_wizard_bus_name (OfonoWizard *ofono_wizard)
 {
-	GError *error = NULL;
-
 	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (ofono_wizard);
-	priv->modem_path = g_strdup (modem_path);
-
-	priv->modem = modem_proxy_new_for_bus_sync (G_BUS_TYPE_SYSTEM,
-						    G_DBUS_PROXY_FLAGS_NONE,
-						    "org.ofono",
-						    modem_path,
-						    NULL,
-						    &error);
 
-	if (priv->modem == NULL) {
-		g_warning ("Unable to get Modem Proxy: %s", error->message);
-		g_error_free (error);
-		exit (0);
-	}
+	return priv->ofono_name ? priv->ofono_name : "org.ofono";
+}
 
-	modem_call_get_properties (priv->modem, NULL, modem_get_properties_cb, ofono_wizard);
+static gpointer
+ofono_wizard_proxy_new (OfonoWizard        *ofono_wizard,
+			GType               type,
+			GDBusInterfaceInfo *info,
+			const gchar        *path,
+			gboolean            signals,
+			GError            **error)
+{
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (ofono_wizard);
+	gpointer proxy;
+
+	proxy = g_initable_new (type, priv->cancellable, error,
+				"g-flags", ofono_wizard_proxy_flags (signals),
+				"g-name", ofono_wizard_bus_name (ofono_wizard),
+				"g-connection", priv->connection,
+				"g-object-path", path,
+				"g-interface-name", info->name,
+				NULL);
+	if (proxy)
+		ofono_wizard_set_call_timeout (ofono_wizard, proxy);
+
+	return proxy;
 }
 
+/* The callback finishes with g_async_initable_new_finish() */
 static void
-connection_context_set_active (GObject      *source_object,
-			       GAsyncResult *res,
-			       gpointer      user_data)
+ofono_wizard_proxy_new_async (OfonoWizard        *ofono_wizard,
+			      GType               type,
+			      GDBusInterfaceInfo *info,
+			      const gchar        *path,
+			      gboolean            signals,
+			      GAsyncReadyCallback callback,
+			      gpointer            user_data)
 {
-	GError *error = NULL;
-	gboolean ret;
-
-	OfonoWizard *wizard = user_data;
-	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (wizard);
-
-	ret = connection_context_call_set_property_finish (priv->context, res, &error);
-	if (!ret) {
-		g_warning ("Unable to set Context Property:Active : %s", error->message);
-		g_error_free (error);
-		if (error->code != 36)
-			gtk_main_quit ();
-	}
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (ofono_wizard);
 
-	connection_context_call_set_property (priv->context,
-					      "AccessPointName",
-					      g_variant_new_variant (g_variant_new_string (priv->selected_apn)),
-					      NULL,
-					      connection_context_set_apn,
-					      wizard);
+	g_async_initable_new_async (type, G_PRIORITY_DEFAULT, priv->cancellable,
+				    callback, user_data,
+				    "g-flags", ofono_wizard_proxy_flags (signals),
+				    "g-name", ofono_wizard_bus_name (ofono_wizard),
+				    "g-connection", priv->connection,
+				    "g-object-path", path,
+				    "g-interface-name", info->name,
+				    NULL);
 }
 
-static void
-connection_context_set_plan (GObject      *source_object,
-			     GAsyncResult *res,
-			     gpointer      user_data)
+static gboolean
+ofono_wizard_deadline_expired (gpointer user_data)
 {
-	GError *error = NULL;
-	gboolean ret;
-
 	OfonoWizard *wizard = user_data;
 	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (wizard);
 
-	ret = connection_context_call_set_property_finish (priv->context, res, &error);
-	if (!ret) {
-		if (error->code != 36)
-			g_warning ("Unable to set Context Property:Plan : %s", error->message);
-		g_error_free (error);
+	priv->deadline_id = 0;
+
+	g_warning ("Gave up %s, oFono took longer than %u ms", priv->step, priv->deadline);
+
+	ofono_wizard_release_modem (wizard);
+
+	if (priv->assistant) {
+		gtk_widget_destroy (priv->assistant);
+		priv->assistant = NULL;
 	}
 
 	gtk_main_quit ();
+
+	return FALSE;
 }
 
+/* Keeps running when already armed, so a stretch is timed as a whole */
 static void
-connection_context_set_password (GObject      *source_object,
-				 GAsyncResult *res,
-				 gpointer      user_data)
+ofono_wizard_deadline_start (OfonoWizard *ofono_wizard, const gchar *step)
 {
-	GError *error = NULL;
-	gboolean ret;
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (ofono_wizard);
 
-	OfonoWizard *wizard = user_data;
-	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (wizard);
+	priv->step = step;
 
-	ret = connection_context_call_set_property_finish (priv->context, res, &error);
-	if (!ret) {
-		g_warning ("Unable to set Context Property:Password : %s", error->message);
-		g_error_free (error);
-		if (error->code != 36)
-			gtk_main_quit ();
-	}
+	if (priv->deadline_id == 0 && priv->deadline > 0)
+		priv->deadline_id = g_timeout_add (priv->deadline,
+						   ofono_wizard_deadline_expired,
+						   ofono_wizard);
+}
 
-	if (strcmp (priv->selected_plan, _("My plan is not listed..."))) {
-		connection_context_call_set_property (priv->context,
-						      "Name",
-						      g_variant_new_variant (g_variant_new_string (priv->selected_plan)),
-						      NULL,
-						      connection_context_set_plan,
-						      wizard);
-	} else {
-		connection_context_call_set_property (priv->context,
-						      "Name",
-						      g_variant_new_variant (g_variant_new_string (priv->selected_apn)),
-						      NULL,
-						      connection_context_set_plan,
-						      wizard);
+static void
+ofono_wizard_deadline_stop (OfonoWizard *ofono_wizard)
+{
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (ofono_wizard);
+
+	if (priv->deadline_id) {
+		g_source_remove (priv->deadline_id);
+		priv->deadline_id = 0;
 	}
 }
 
 static void
-connection_context_set_username (GObject      *source_object,
-				 GAsyncResult *res,
-				 gpointer      user_data)
+ofono_wizard_release_modem (OfonoWizard *ofono_wizard)
 {
-	GError *error = NULL;
-	gboolean ret;
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (ofono_wizard);
 
-	OfonoWizard *wizard = user_data;
-	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (wizard);
+	g_cancellable_cancel (priv->cancellable);
+	ofono_wizard_deadline_stop (ofono_wizard);
 
-	ret = connection_context_call_set_property_finish (priv->context, res, &error);
-	if (!ret) {
-		g_warning ("Unable to set Context Property:Username : %s", error->message);
-		g_error_free (error);
-		if (error->code != 36)
-			gtk_main_quit ();
+	if (priv->modem_watch) {
+		g_dbus_connection_signal_unsubscribe (priv->connection, priv->modem_watch);
+		priv->modem_watch = 0;
 	}
+	if (priv->sim_manager)
+		g_signal_handlers_disconnect_by_data (priv->sim_manager, ofono_wizard);
 
-	if (priv->selected_password) {
-		connection_context_call_set_property (priv->context,
-						      "Password",
-						      g_variant_new_variant (g_variant_new_string (priv->selected_password)),
-						      NULL,
-						      connection_context_set_password,
-						      wizard);
-	} else {
-		connection_context_call_set_property (priv->context,
-						      "Password",
-						      g_variant_new_variant (g_variant_new_string ("")),
-						      NULL,
-						      connection_context_set_password,
-						      wizard);
-	}
+	g_clear_object (&priv->sim_manager);
+	g_clear_object (&priv->ConnectionManager);
+	g_hash_table_remove_all (priv->contexts);
 }
 
+/* The modem is gone, whatever we were doing with it */
 static void
-connection_context_set_apn (GObject      *source_object,
-			    GAsyncResult *res,
-			    gpointer      user_data)
+ofono_wizard_modem_gone (OfonoWizard *ofono_wizard)
 {
-	GError *error = NULL;
-	gboolean ret;
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (ofono_wizard);
+
+	ofono_wizard_release_modem (ofono_wizard);
+
+	if (priv->assistant) {
+		gtk_widget_destroy (priv->assistant);
+		priv->assistant = NULL;
+	}
+
+	gtk_main_quit ();
+}
 
+static void
+manager_modem_removed (Manager     *manager,
+		       const gchar *path,
+		       gpointer     user_data)
+{
 	OfonoWizard *wizard = user_data;
 	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (wizard);
 
-	ret = connection_context_call_set_property_finish (priv->context, res, &error);
-	if (!ret) {
-		g_warning ("Unable to set Context Property:APN : %s", error->message);
+	if (g_strcmp0 (path, priv->modem_path))
+		return;
+
+	g_warning ("Modem %s was removed", path);
+
+	ofono_wizard_modem_gone (wizard);
+}
+
+static void
+ofono_vanished (GDBusConnection *connection,
+		const gchar     *name,
+		gpointer         user_data)
+{
+	OfonoWizard *wizard = user_data;
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (wizard);
+
+	/* Also called right away when nobody owned it to begin with */
+	if (priv->ofono_name == NULL)
+		return;
+
+	g_warning ("oFono left the bus");
+
+	ofono_wizard_modem_gone (wizard);
+}
+static void
+connection_manager_get_contexts_cb (GObject      *source_object,
+				    GAsyncResult *res,
+				    gpointer      user_data)
+{
+	GError *error = NULL;
+	GVariant *result, *properties;
+	GVariantIter array_iter;
+	OfonoContext *context;
+	const gchar *path, *type;
+
+	OfonoWizard *wizard = user_data;
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (wizard);
+
+	if (!connection_manager_call_get_contexts_finish (CONNECTION_MANAGER (source_object), &result, res, &error)) {
+		if (call_cancelled (error))
+			return;
+		ofono_wizard_call_failed (wizard, error, "getting the contexts");
 		g_error_free (error);
-		if (error->code != 36)
-			gtk_main_quit ();
+		exit (0);
 	}
 
-	if (priv->selected_username) {
-		connection_context_call_set_property (priv->context,
-						      "Username",
-						      g_variant_new_variant (g_variant_new_string (priv->selected_username)),
-						      NULL,
-						      connection_context_set_username,
-						      wizard);
-	} else {
-		connection_context_call_set_property (priv->context,
-						      "Username",
-						      g_variant_new_variant (g_variant_new_string ("")),
-						      NULL,
-						      connection_context_set_username,
-						      wizard);
+	/* Result is  (a(oa{sv})), keep the first context of each type */
+	g_variant_iter_init (&array_iter, result);
+
+	while (g_variant_iter_next (&array_iter, "(&o@a{sv})", &path, &properties)) {
+		if (!g_variant_lookup (properties, "Type", "&s", &type) ||
+		    g_hash_table_lookup (priv->contexts, type)) {
+			g_variant_unref (properties);
+			continue;
+		}
+
+		context = ofono_context_new (wizard, type, path);
+
+		/* Check if the context if active */
+		if (!g_variant_lookup (properties, "Active", "b", &context->active))
+			context->active = TRUE;
+
+		g_hash_table_insert (priv->contexts, context->type, context);
+		g_variant_unref (properties);
+
+		ofono_context_connect (context);
 	}
+
+	g_variant_unref (result);
+
+	/* Missing contexts are added when the settings are applied */
+	context = g_hash_table_lookup (priv->contexts, "internet");
+	priv->active = context && context->active;
+
+	/* Time with the user doesn't count */
+	ofono_wizard_deadline_stop (wizard);
+	ofono_wizard_setup_assistant (wizard);
 }
 
 static void
-ofono_wizard_setup_context (OfonoWizard *ofono_wizard, gchar *apn, gchar *username, gchar *password)
+ofono_wizard_get_modem_context (OfonoWizard *ofono_wizard)
 {
 	GError *error = NULL;
-	gboolean ret;
 
 	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (ofono_wizard);
+	
+	priv->ConnectionManager = ofono_wizard_proxy_new (ofono_wizard, TYPE_CONNECTION_MANAGER_PROXY,
+							  connection_manager_interface_info (),
+							  priv->modem_path, FALSE, &error);
+
+	if (priv->ConnectionManager == NULL) {
+		g_warning ("Unable to get Modem connection Manager: %s", error->message);
+		g_error_free (error);
+		exit (0);
+	}
+
+	ofono_wizard_deadline_start (ofono_wizard, "getting the contexts");
+	connection_manager_call_get_contexts (priv->ConnectionManager, priv->cancellable, connection_manager_get_contexts_cb ,ofono_wizard);
+}
+
+static gboolean
+strv_contains (const gchar * const *strv, const gchar *str)
+{
+	for (; strv && *strv; strv++) {
+		if (!strcmp (*strv, str))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* PropertyChanged delivers the value boxed in a 'v', unwrap it */
+static GVariant *
+property_value_unbox (GVariant *value)
+{
+	if (g_variant_is_of_type (value, G_VARIANT_TYPE_VARIANT))
+		return g_variant_get_variant (value);
+
+	return g_variant_ref (value);
+}
+
+static void
+ofono_wizard_update_interfaces (OfonoWizard *ofono_wizard, const gchar * const *interfaces)
+{
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (ofono_wizard);
 
-	priv->context = connection_context_proxy_new_for_bus_sync (G_BUS_TYPE_SYSTEM,
-								   G_DBUS_PROXY_FLAGS_NONE,
-								   "org.ofono",
-								   priv->context_path,
-								   NULL,
-								   &error);
+	priv->has_sim_manager = strv_contains (interfaces, "org.ofono.SimManager");
+	priv->has_connection_manager = strv_contains (interfaces, "org.ofono.ConnectionManager");
+
+	/* SIM went away, forget what we learnt from it */
+	if (!priv->has_sim_manager && priv->sim_manager) {
+		g_object_unref (priv->sim_manager);
+		priv->sim_manager = NULL;
+		g_free (priv->mcc);
+		priv->mcc = NULL;
+		priv->sim_unavailable = FALSE;
+	}
+
+	ofono_wizard_advance (ofono_wizard);
+}
+
+/* Not worth a Modem proxy, Interfaces is all we follow */
+static void
+modem_property_changed (GDBusConnection *connection,
+			const gchar     *sender_name,
+			const gchar     *object_path,
+			const gchar     *interface_name,
+			const gchar     *signal_name,
+			GVariant        *parameters,
+			gpointer         user_data)
+{
+	OfonoWizard *wizard = user_data;
+	const gchar *name;
+	GVariant *v;
+
+	if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(sv)")))
+		return;
+
+	g_variant_get (parameters, "(&sv)", &name, &v);
+	if (!strcmp (name, "Interfaces") &&
+	    g_variant_is_of_type (v, G_VARIANT_TYPE_STRING_ARRAY)) {
+		const gchar **interfaces = g_variant_get_strv (v, NULL);
+
+		ofono_wizard_update_interfaces (wizard, interfaces);
+		g_free (interfaces);
+	}
+	g_variant_unref (v);
+}
+
+static gchar *
+modem_display_name (GVariant *properties)
+{
+	const gchar *name, *manufacturer = NULL, *model = NULL;
+
+	if (g_variant_lookup (properties, "Name", "&s", &name))
+		return g_strdup (name);
+
+	g_variant_lookup (properties, "Manufacturer", "&s", &manufacturer);
+	g_variant_lookup (properties, "Model", "&s", &model);
+
+	if (manufacturer && model)
+		return g_strdup_printf ("%s-%s", manufacturer, model);
+	else if (manufacturer)
+		return g_strdup (manufacturer);
+
+	return g_strdup ("Modem");
+}
+
+static void
+ofono_wizard_list_modems (GVariant *modems)
+{
+	GVariantIter iter;
+	GVariant *properties;
+	const gchar *path, *type;
+	gchar *name;
+
+	if (g_variant_n_children (modems) == 0) {
+		g_print (_("No modems found.\n"));
+		return;
+	}
+
+	g_print (_("Provide a modem path, one of:\n"));
+
+	g_variant_iter_init (&iter, modems);
+	while (g_variant_iter_next (&iter, "(&o@a{sv})", &path, &properties)) {
+		if (!g_variant_lookup (properties, "Type", "&s", &type))
+			type = "unknown";
+
+		name = modem_display_name (properties);
+		g_print ("  %s\t%s (%s)\n", path, name, type);
+		g_free (name);
+		g_variant_unref (properties);
+	}
+}
 
-	if (priv->context == NULL) {
-		g_warning ("Unable to get Modem context: %s", error->message);
+/* Everything we need to know about the modem comes with GetModems */
+static void
+ofono_wizard_use_modem (OfonoWizard *ofono_wizard, GVariant *properties)
+{
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (ofono_wizard);
+	const gchar *type;
+	gchar **interfaces;
+
+	/* Test for Type=Hardware here */
+	if (!g_variant_lookup (properties, "Type", "&s", &type)) {
+		g_warning ("Unable to determine modem type");
+		exit (0);
+	}
+
+	if (strcmp (type, "hardware")) {
+		g_warning ("Not a real hardware modem");
+		exit (0);
+	}
+
+	priv->name = modem_display_name (properties);
+
+	if (!g_variant_lookup (properties, "Interfaces", "^as", &interfaces)) {
+		g_warning ("Unable to get modem interfaces");
+		exit (0);
+	}
+
+	/* Missing interfaces are not fatal, they show up via PropertyChanged */
+	ofono_wizard_update_interfaces (ofono_wizard, (const gchar * const *) interfaces);
+	g_strfreev (interfaces);
+}
+
+static void
+manager_get_modems_cb (GObject      *source_object,
+		       GAsyncResult *res,
+		       gpointer      user_data)
+{
+	GError *error = NULL;
+	GVariant *modems = NULL;
+	GVariant *properties;
+	GVariantIter iter;
+	const gchar *path;
+
+	OfonoWizard *wizard = user_data;
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (wizard);
+
+	if (!manager_call_get_modems_finish (MANAGER (source_object), &modems, res, &error)) {
+		if (call_cancelled (error))
+			return;
+		ofono_wizard_call_failed (wizard, error, "getting the modems");
 		g_error_free (error);
+		exit (0);
+	}
+
+	if (priv->modem_path == NULL) {
+		ofono_wizard_deadline_stop (wizard);
+		ofono_wizard_list_modems (modems);
+		g_variant_unref (modems);
 		gtk_main_quit ();
+		return;
 	}
 
-	if (priv->active) {
-		connection_context_call_set_property (priv->context,
-						      "Active",
-						      g_variant_new_variant (g_variant_new_boolean (FALSE)),
-						      NULL,
-						      connection_context_set_active,
-						      ofono_wizard);
+	/* Result is a(oa{sv}) */
+	g_variant_iter_init (&iter, modems);
+	while (g_variant_iter_next (&iter, "(&o@a{sv})", &path, &properties)) {
+		if (!strcmp (path, priv->modem_path)) {
+			ofono_wizard_use_modem (wizard, properties);
+			g_variant_unref (properties);
+			g_variant_unref (modems);
+			return;
+		}
+		g_variant_unref (properties);
+	}
+
+	g_warning ("No modem at %s", priv->modem_path);
+	ofono_wizard_list_modems (modems);
+	g_variant_unref (modems);
+	exit (0);
+}
+
+/* A NULL path lists the modems instead */
+void
+ofono_wizard_setup_modem (OfonoWizard *ofono_wizard, gchar *modem_path)
+{
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (ofono_wizard);
+
+	priv->modem_path = g_strdup (modem_path);
+
+	if (modem_path) {
+		g_signal_connect (priv->manager, "modem-removed",
+				  G_CALLBACK (manager_modem_removed), ofono_wizard);
+
+		/* Subscribed before asking, so no change slips in between */
+		priv->modem_watch = g_dbus_connection_signal_subscribe (priv->connection,
+									ofono_wizard_bus_name (ofono_wizard),
+									"org.ofono.Modem",
+									"PropertyChanged",
+									modem_path,
+									NULL,
+									G_DBUS_SIGNAL_FLAGS_NONE,
+									modem_property_changed,
+									ofono_wizard,
+									NULL);
+	}
+
+	ofono_wizard_deadline_start (ofono_wizard, "getting the modems");
+	manager_call_get_modems (priv->manager, priv->cancellable, manager_get_modems_cb, ofono_wizard);
+}
+
+/**********************************************************/
+/* Applying the settings */
+/**********************************************************/
+
+static OfonoContext *
+ofono_context_new (OfonoWizard *ofono_wizard, const gchar *type, const gchar *path)
+{
+	OfonoContext *context;
+
+	context = g_slice_new0 (OfonoContext);
+	context->wizard = ofono_wizard;
+	context->type = g_strdup (type);
+	context->path = g_strdup (path);
+
+	return context;
+}
+
+static void
+ofono_context_free (gpointer data)
+{
+	OfonoContext *context = data;
+
+	if (context->proxy) {
+		g_signal_handlers_disconnect_by_data (context->proxy, context);
+		g_object_unref (context->proxy);
+	}
+
+	if (context->properties)
+		g_variant_unref (context->properties);
+	if (context->settings)
+		g_variant_unref (context->settings);
+
+	g_free (context->type);
+	g_free (context->path);
+
+	g_slice_free (OfonoContext, context);
+}
+
+/* One call less in flight, everything is applied once none are left */
+static void
+ofono_wizard_apply_complete (OfonoWizard *ofono_wizard)
+{
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (ofono_wizard);
+
+	if (--priv->pending)
+		return;
+
+	ofono_wizard_deadline_stop (ofono_wizard);
+	gtk_main_quit ();
+}
+
+static void
+connection_context_property_changed (ConnectionContext *proxy,
+				     const gchar       *name,
+				     GVariant          *value,
+				     gpointer           user_data)
+{
+	OfonoContext *context = user_data;
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (context->wizard);
+	GVariant *v;
+
+	if (strcmp (name, "Active"))
+		return;
+
+	v = property_value_unbox (value);
+	if (g_variant_is_of_type (v, G_VARIANT_TYPE_BOOLEAN)) {
+		context->active = g_variant_get_boolean (v);
+		if (!strcmp (context->type, "internet"))
+			priv->active = context->active;
+	}
+	g_variant_unref (v);
+}
+
+static void
+ofono_context_apply (OfonoContext *context);
+
+/* Run the apply that was waiting on us, it held one pending count */
+static void
+ofono_context_ready (OfonoContext *context)
+{
+	context->ready = TRUE;
+
+	if (!context->apply_queued)
+		return;
+
+	context->apply_queued = FALSE;
+	ofono_context_apply (context);
+	ofono_wizard_apply_complete (context->wizard);
+}
+
+static void
+connection_context_get_properties_cb (GObject      *source_object,
+				      GAsyncResult *res,
+				      gpointer      user_data)
+{
+	OfonoContext *context = user_data;
+	OfonoWizardPrivate *priv;
+	GError *error = NULL;
+	gboolean active;
+
+	if (!connection_context_call_get_properties_finish (CONNECTION_CONTEXT (source_object),
+							    &context->properties, res, &error)) {
+		if (call_cancelled (error))
+			return;
+		ofono_wizard_call_failed (context->wizard, error,
+					  "getting the %s context properties", context->type);
+		g_error_free (error);
+
+		/* Not fatal, the settings can still be sent */
+		ofono_context_ready (context);
+		return;
+	}
+
+	/* Fresher than what GetContexts said */
+	priv = OFONO_WIZARD_GET_PRIVATE (context->wizard);
+	if (g_variant_lookup (context->properties, "Active", "b", &active)) {
+		context->active = active;
+		if (!strcmp (context->type, "internet"))
+			priv->active = active;
+	}
+
+	ofono_context_ready (context);
+}
+
+static void
+connection_context_proxy_new_cb (GObject      *source_object,
+				 GAsyncResult *res,
+				 gpointer      user_data)
+{
+	OfonoContext *context = user_data;
+	OfonoWizardPrivate *priv;
+	ConnectionContext *proxy;
+	GError *error = NULL;
+
+	proxy = connection_context_proxy_new_finish (res, &error);
+	if (proxy == NULL) {
+		if (call_cancelled (error))
+			return;
+		g_warning ("Unable to get the %s context: %s", context->type, error->message);
+		g_error_free (error);
+		ofono_context_ready (context);
+		return;
+	}
+
+	priv = OFONO_WIZARD_GET_PRIVATE (context->wizard);
+
+	context->proxy = proxy;
+	ofono_wizard_set_call_timeout (context->wizard, context->proxy);
+
+	g_signal_connect (context->proxy, "property-changed",
+			  G_CALLBACK (connection_context_property_changed), context);
+
+	connection_context_call_get_properties (context->proxy, priv->cancellable,
+						connection_context_get_properties_cb,
+						context);
+}
+
+/* Get the context ready to be applied while the user is busy */
+static void
+ofono_context_connect (OfonoContext *context)
+{
+	ofono_wizard_proxy_new_async (context->wizard, TYPE_CONNECTION_CONTEXT_PROXY,
+				      connection_context_interface_info (),
+				      context->path, TRUE,
+				      connection_context_proxy_new_cb, context);
+}
+
+static void
+context_setting_free (ContextSetting *setting)
+{
+	g_free (setting->name);
+	g_variant_unref (setting->value);
+
+	g_slice_free (ContextSetting, setting);
+}
+
+static void
+ofono_context_send_setting (ContextSetting *setting)
+{
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (setting->context->wizard);
+
+	connection_context_call_set_property (setting->context->proxy,
+					      setting->name,
+					      g_variant_new_variant (setting->value),
+					      priv->cancellable,
+					      setting->callback,
+					      setting);
+}
+
+static gboolean
+ofono_context_resend_setting (gpointer user_data)
+{
+	ContextSetting *setting = user_data;
+	OfonoWizard *wizard = setting->context->wizard;
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (wizard);
+
+	/* Torn down while we were waiting, the context may be gone */
+	if (g_cancellable_is_cancelled (priv->cancellable)) {
+		context_setting_free (setting);
+		return FALSE;
+	}
+
+	ofono_context_send_setting (setting);
+
+	return FALSE;
+}
+
+/*
+ * oFono refuses changes while the context is still (de)activating.
+ * Try again after 100, 200, 400, ... ms; the apply deadline bounds the
+ * total time spent, SETTING_MAX_RETRIES the number of attempts.
+ */
+#define SETTING_RETRY_DELAY 100
+#define SETTING_MAX_RETRIES 6
+
+static gboolean
+ofono_context_retry_setting (ContextSetting *setting, GError *error)
+{
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (setting->context->wizard);
+	gchar *remote;
+	gboolean busy;
+
+	if (setting->attempts == SETTING_MAX_RETRIES ||
+	    g_cancellable_is_cancelled (priv->cancellable))
+		return FALSE;
+
+	remote = g_dbus_error_get_remote_error (error);
+	busy = !g_strcmp0 (remote, "org.ofono.Error.InProgress") ||
+	       !g_strcmp0 (remote, "org.ofono.Error.InUse") ||
+	       !g_strcmp0 (remote, "org.ofono.Error.Busy");
+	g_free (remote);
+
+	if (!busy)
+		return FALSE;
+
+	g_message ("The %s context is busy, retrying %s", setting->context->type, setting->name);
+
+	g_timeout_add (SETTING_RETRY_DELAY << setting->attempts++,
+		       ofono_context_resend_setting, setting);
+
+	return TRUE;
+}
+
+static ContextSetting *
+context_setting_new (OfonoContext *context,
+		     const gchar *name,
+		     GVariant *value,
+		     GAsyncReadyCallback callback);
+
+static void
+connection_context_activate_cb (GObject      *source_object,
+				GAsyncResult *res,
+				gpointer      user_data)
+{
+	ContextSetting *setting = user_data;
+	OfonoContext *context = setting->context;
+	GError *error = NULL;
+
+	if (!connection_context_call_set_property_finish (CONNECTION_CONTEXT (source_object), res, &error)) {
+		if (call_cancelled (error)) {
+			context_setting_free (setting);
+			return;
+		}
+		if (ofono_context_retry_setting (setting, error)) {
+			g_error_free (error);
+			return;
+		}
+		ofono_wizard_call_failed (context->wizard, error,
+					  "reactivating the %s context", context->type);
+		g_error_free (error);
+	} else
+		g_message ("The %s context was down for %" G_GINT64_FORMAT " ms",
+			   context->type, (g_get_monotonic_time () - context->down_since) / 1000);
+
+	context->down_since = 0;
+
+	ofono_wizard_apply_complete (context->wizard);
+	context_setting_free (setting);
+}
+
+/*
+ * Once the last setting is answered, written or not, bring a context we
+ * took down back up. oFono won't activate with writes still queued.
+ */
+static void
+ofono_context_write_done (OfonoContext *context)
+{
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (context->wizard);
+
+	if (--context->writes || context->down_since == 0)
+		return;
+
+	priv->pending++;
+	ofono_context_send_setting (context_setting_new (context, "Active",
+							 g_variant_new_boolean (TRUE),
+							 connection_context_activate_cb));
+}
+
+static void
+connection_context_set_property_cb (GObject      *source_object,
+				    GAsyncResult *res,
+				    gpointer      user_data)
+{
+	ContextSetting *setting = user_data;
+	GError *error = NULL;
+
+	if (!connection_context_call_set_property_finish (CONNECTION_CONTEXT (source_object), res, &error)) {
+		if (call_cancelled (error)) {
+			context_setting_free (setting);
+			return;
+		}
+		if (ofono_context_retry_setting (setting, error)) {
+			g_error_free (error);
+			return;
+		}
+		ofono_wizard_call_failed (setting->context->wizard, error,
+					  "setting %s on the %s context", setting->name,
+					  setting->context->type);
+		g_error_free (error);
+	}
+
+	ofono_context_write_done (setting->context);
+	ofono_wizard_apply_complete (setting->context->wizard);
+	context_setting_free (setting);
+}
+
+static ContextSetting *
+context_setting_new (OfonoContext *context,
+		     const gchar *name,
+		     GVariant *value,
+		     GAsyncReadyCallback callback)
+{
+	ContextSetting *setting = g_slice_new0 (ContextSetting);
+
+	setting->context = context;
+	setting->name = g_strdup (name);
+	setting->value = g_variant_ref_sink (value);
+	setting->callback = callback;
+
+	return setting;
+}
+
+/* Send every setting at once, oFono handles them in order */
+static void
+ofono_context_apply_settings (OfonoContext *context)
+{
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (context->wizard);
+	GVariantIter iter;
+	const gchar *name;
+	GVariant *value;
+
+	g_variant_iter_init (&iter, context->settings);
+	while (g_variant_iter_next (&iter, "{&sv}", &name, &value)) {
+		priv->pending++;
+		context->writes++;
+		ofono_context_send_setting (context_setting_new (context, name, value,
+								 connection_context_set_property_cb));
+		g_variant_unref (value);
+	}
+}
+
+static void
+connection_context_deactivate_cb (GObject      *source_object,
+				  GAsyncResult *res,
+				  gpointer      user_data)
+{
+	ContextSetting *setting = user_data;
+	OfonoContext *context = setting->context;
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (context->wizard);
+	GError *error = NULL;
+
+	if (!connection_context_call_set_property_finish (CONNECTION_CONTEXT (source_object), res, &error)) {
+		if (call_cancelled (error)) {
+			context_setting_free (setting);
+			return;
+		}
+		if (ofono_context_retry_setting (setting, error)) {
+			g_error_free (error);
+			return;
+		}
+		ofono_wizard_call_failed (context->wizard, error,
+					  "deactivating the %s context", context->type);
+		g_error_free (error);
+		ofono_wizard_apply_complete (context->wizard);
+		context_setting_free (setting);
+		return;
+	}
+
+	context_setting_free (setting);
+
+	/* The data connection is gone from here until the reactivation */
+	if (priv->reactivate)
+		context->down_since = g_get_monotonic_time ();
+
+	/* Settings of an active context can't be changed */
+	ofono_context_apply_settings (context);
+	ofono_wizard_apply_complete (context->wizard);
+}
+
+/* oFono refuses everything but the name while the context is active */
+static gboolean
+setting_needs_deactivation (const gchar *name)
+{
+	return strcmp (name, "Name") != 0;
+}
+
+/*
+ * Drop the settings the context already has, NULL if none are left.
+ * Without properties to compare with, everything is sent.
+ */
+static GVariant *
+ofono_context_changed_settings (OfonoContext *context, gboolean *needs_deactivation)
+{
+	GVariantBuilder builder;
+	GVariantIter iter;
+	const gchar *name;
+	GVariant *value, *current;
+	gboolean changed = FALSE;
+
+	*needs_deactivation = FALSE;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+
+	g_variant_iter_init (&iter, context->settings);
+	while (g_variant_iter_next (&iter, "{&sv}", &name, &value)) {
+		current = NULL;
+		if (context->properties)
+			current = g_variant_lookup_value (context->properties, name, NULL);
+
+		if (current == NULL || !g_variant_equal (current, value)) {
+			g_variant_builder_add (&builder, "{sv}", name, value);
+			*needs_deactivation |= setting_needs_deactivation (name);
+			changed = TRUE;
+		}
+
+		if (current)
+			g_variant_unref (current);
+		g_variant_unref (value);
+	}
+
+	if (!changed) {
+		g_variant_builder_clear (&builder);
+		return NULL;
+	}
+
+	return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static void
+ofono_context_apply (OfonoContext *context)
+{
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (context->wizard);
+	gboolean needs_deactivation;
+	GVariant *changed;
+
+	if (!context->ready) {
+		context->apply_queued = TRUE;
+		priv->pending++;
+		return;
+	}
+
+	/* Already warned about when the proxy failed */
+	if (context->proxy == NULL)
+		return;
+
+	changed = ofono_context_changed_settings (context, &needs_deactivation);
+	g_variant_unref (context->settings);
+	context->settings = changed;
+
+	if (changed == NULL) {
+		g_message ("The %s context is already set up", context->type);
+		return;
+	}
+
+	if (context->active && needs_deactivation) {
+		priv->pending++;
+		ofono_context_send_setting (context_setting_new (context, "Active",
+								 g_variant_new_boolean (FALSE),
+								 connection_context_deactivate_cb));
+	} else
+		ofono_context_apply_settings (context);
+}
+
+static void
+connection_manager_add_context_cb (GObject      *source_object,
+				   GAsyncResult *res,
+				   gpointer      user_data)
+{
+	OfonoContext *context = user_data;
+	GError *error = NULL;
+
+	if (!connection_manager_call_add_context_finish (CONNECTION_MANAGER (source_object),
+							 &context->path, res, &error)) {
+		if (call_cancelled (error))
+			return;
+		ofono_wizard_call_failed (context->wizard, error,
+					  "adding a %s context", context->type);
+		g_error_free (error);
 	} else {
-		connection_context_call_set_property (priv->context,
-						      "AccessPointName",
-						      g_variant_new_variant (g_variant_new_string (priv->selected_apn)),
-						      NULL,
-						      connection_context_set_apn,
-						      ofono_wizard);
+		ofono_context_connect (context);
+		ofono_context_apply (context);
 	}
+
+	ofono_wizard_apply_complete (context->wizard);
+}
+
+static GVariant *
+ofono_wizard_internet_settings (OfonoWizardPrivate *priv)
+{
+	GVariantBuilder builder;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+
+	g_variant_builder_add (&builder, "{sv}", "AccessPointName",
+			       g_variant_new_string (priv->selected_apn));
+	g_variant_builder_add (&builder, "{sv}", "Username",
+			       g_variant_new_string (priv->selected_username ? priv->selected_username : ""));
+	g_variant_builder_add (&builder, "{sv}", "Password",
+			       g_variant_new_string (priv->selected_password ? priv->selected_password : ""));
+	g_variant_builder_add (&builder, "{sv}", "Name",
+			       g_variant_new_string (priv->selected_plan ? priv->selected_plan : priv->selected_apn));
+
+	return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static GVariant *
+ofono_wizard_mms_settings (const PlanInfo *mms)
+{
+	GVariantBuilder builder;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+
+	g_variant_builder_add (&builder, "{sv}", "AccessPointName",
+			       g_variant_new_string (mms->apn));
+	g_variant_builder_add (&builder, "{sv}", "Username",
+			       g_variant_new_string (mms->username ? mms->username : ""));
+	g_variant_builder_add (&builder, "{sv}", "Password",
+			       g_variant_new_string (mms->password ? mms->password : ""));
+	g_variant_builder_add (&builder, "{sv}", "MessageCenter",
+			       g_variant_new_string (mms->mmsc ? mms->mmsc : ""));
+	g_variant_builder_add (&builder, "{sv}", "MessageProxy",
+			       g_variant_new_string (mms->mmsproxy ? mms->mmsproxy : ""));
+
+	return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+static void
+ofono_wizard_apply_context (OfonoWizard *ofono_wizard, const gchar *type, GVariant *settings)
+{
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (ofono_wizard);
+	OfonoContext *context;
+
+	context = g_hash_table_lookup (priv->contexts, type);
+	if (context) {
+		context->settings = settings;
+		ofono_context_apply (context);
+		return;
+	}
+
+	/* No such context on the modem yet, have oFono create one */
+	context = ofono_context_new (ofono_wizard, type, NULL);
+	context->settings = settings;
+	g_hash_table_insert (priv->contexts, context->type, context);
+
+	priv->pending++;
+	connection_manager_call_add_context (priv->ConnectionManager,
+					     type,
+					     priv->cancellable,
+					     connection_manager_add_context_cb,
+					     context);
+}
+
+/*
+ * Provision the internet context and, when the provider has one, the MMS
+ * context in a single batch. pending counts the calls in flight, it
+ * starts at one so nothing completes before everything is sent.
+ */
+static void
+ofono_wizard_apply_contexts (OfonoWizard *ofono_wizard)
+{
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (ofono_wizard);
+	const PlanInfo *mms = NULL;
+
+	priv->pending = 1;
+	ofono_wizard_deadline_start (ofono_wizard, "applying the settings");
+
+	ofono_wizard_apply_context (ofono_wizard, "internet",
+				    ofono_wizard_internet_settings (priv));
+
+	/* Only providers from the database come with MMS settings */
+	mms = mobile_provider_database_get_mms_info (priv->db, priv->selected_country,
+						     priv->selected_provider);
+	if (mms)
+		ofono_wizard_apply_context (ofono_wizard, "mms", ofono_wizard_mms_settings (mms));
+
+	ofono_wizard_apply_complete (ofono_wizard);
 }
 
 static void
@@ -1602,29 +2617,58 @@ sim_manager_get_properties_cb (GObject      *source_object,
 {
 	GError *error = NULL;
 	GVariant *result = NULL;
-	GVariant *value = NULL;
 	gboolean ret;
 	const gchar *mcc;
 
 	OfonoWizard *wizard = user_data;
 	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (wizard);
 
-	ret = sim_manager_call_get_properties_finish (priv->sim_manager, &result, res, &error);
+	ret = sim_manager_call_get_properties_finish (SIM_MANAGER (source_object), &result, res, &error);
 	if (!ret) {
-		g_warning ("Unable to get SIM properties: %s", error->message);
+		if (call_cancelled (error))
+			return;
+		ofono_wizard_call_failed (wizard, error, "getting the SIM properties");
 		g_error_free (error);
+		priv->sim_unavailable = TRUE;
 		goto done;
 	}
 
-	ret = g_variant_lookup (result, "MobileCountryCode", "s", &mcc);
-	if (!ret) {
-		g_warning ("Unable to determine SIM MCC");
-	} else
+	/* The SIM was removed while we were asking */
+	if ((gpointer) source_object != (gpointer) priv->sim_manager) {
+		g_variant_unref (result);
+		return;
+	}
+
+	/* Not there until the SIM is inserted and unlocked, PropertyChanged will tell */
+	if (g_variant_lookup (result, "MobileCountryCode", "&s", &mcc) && priv->mcc == NULL)
 		priv->mcc = g_strdup (mcc);
 
 	g_variant_unref (result);
 done:
-		ofono_wizard_get_modem_context (wizard);
+	ofono_wizard_advance (wizard);
+}
+
+static void
+sim_manager_property_changed (SimManager  *sim_manager,
+			      const gchar *name,
+			      GVariant    *value,
+			      gpointer     user_data)
+{
+	OfonoWizard *wizard = user_data;
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (wizard);
+	GVariant *v;
+
+	if (strcmp (name, "MobileCountryCode"))
+		return;
+
+	v = property_value_unbox (value);
+	if (g_variant_is_of_type (v, G_VARIANT_TYPE_STRING)) {
+		g_free (priv->mcc);
+		priv->mcc = g_variant_dup_string (v, NULL);
+	}
+	g_variant_unref (v);
+
+	ofono_wizard_advance (wizard);
 }
 
 static void
@@ -1634,12 +2678,9 @@ ofono_wizard_get_sim_manager (OfonoWizard *ofono_wizard)
 
 	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (ofono_wizard);
 
-	priv->sim_manager = sim_manager_proxy_new_for_bus_sync (G_BUS_TYPE_SYSTEM,
-								G_DBUS_PROXY_FLAGS_NONE,
-								"org.ofono",
-								priv->modem_path,
-								NULL,
-								&error);
+	priv->sim_manager = ofono_wizard_proxy_new (ofono_wizard, TYPE_SIM_MANAGER_PROXY,
+						    sim_manager_interface_info (),
+						    priv->modem_path, TRUE, &error);
 
 	if (priv->sim_manager == NULL) {
 		g_warning ("Unable to get SIM Manager: %s", error->message);
@@ -1647,5 +2688,49 @@ ofono_wizard_get_sim_manager (OfonoWizard *ofono_wizard)
 		exit (0);
 	}
 
-	sim_manager_call_get_properties (priv->sim_manager, NULL, sim_manager_get_properties_cb ,ofono_wizard);
+	g_signal_connect (priv->sim_manager, "property-changed",
+			  G_CALLBACK (sim_manager_property_changed), ofono_wizard);
+
+	ofono_wizard_deadline_start (ofono_wizard, "getting the SIM properties");
+	sim_manager_call_get_properties (priv->sim_manager, priv->cancellable, sim_manager_get_properties_cb ,ofono_wizard);
+}
+
+/*
+ * Move the probe forward as far as the modem currently allows. Called
+ * whenever Interfaces or the SIM MCC change, so hot-plugged modems are
+ * picked up as soon as oFono brings up the SIM and GPRS atoms.
+ */
+static void
+ofono_wizard_advance (OfonoWizard *ofono_wizard)
+{
+	OfonoWizardPrivate *priv = OFONO_WIZARD_GET_PRIVATE (ofono_wizard);
+
+	/* Contexts already requested, nothing left to wait for */
+	if (priv->ConnectionManager)
+		return;
+
+	if (!priv->has_sim_manager) {
+		g_message ("Waiting for the modem to expose a SIM");
+		ofono_wizard_deadline_stop (ofono_wizard);
+		return;
+	}
+
+	if (priv->sim_manager == NULL) {
+		ofono_wizard_get_sim_manager (ofono_wizard);
+		return;
+	}
+
+	if (priv->mcc == NULL && !priv->sim_unavailable) {
+		g_message ("Waiting for the SIM country code");
+		ofono_wizard_deadline_stop (ofono_wizard);
+		return;
+	}
+
+	if (!priv->has_connection_manager) {
+		g_message ("Waiting for the modem to expose data contexts");
+		ofono_wizard_deadline_stop (ofono_wizard);
+		return;
+	}
+
+	ofono_wizard_get_modem_context (ofono_wizard);
 }
@@ -22,6 +22,8 @@
 #include <glib-object.h>
 #include <gtk/gtk.h>
 
+#include "mobile-provider.h"
+
 G_BEGIN_DECLS
 
 typedef struct _OfonoWizard        OfonoWizard;
@@ -46,9 +48,13 @@ struct _OfonoWizardClass {
 
 GType ofono_wizard_get_type (void) G_GNUC_CONST;
 
-OfonoWizard  *ofono_wizard_new (void);
+OfonoWizard  *ofono_wizard_new (MobileProviderDatabase *db, GBusType bus_type);
+void ofono_wizard_set_timeouts (OfonoWizard *ofono_wizard, gint call_timeout, gint deadline);
+/* Reactivate contexts that had to be taken down to apply the settings */
+void ofono_wizard_set_reactivate (OfonoWizard *ofono_wizard, gboolean reactivate);
 
 void ofono_wizard_setup_assistant(OfonoWizard *ofono_wizard);
+/* A NULL path prints the modems oFono knows about and quits */
 void ofono_wizard_setup_modem (OfonoWizard *ofono_wizard, gchar *path);
 
 G_END_DECLS
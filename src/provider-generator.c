@@ -0,0 +1,236 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *  Authors: Alok Barsode <alok.barsode@intel.com>
+ */
+
+/*
+ * Writes a synthetic serviceproviders.xml (format 2.0) and a matching
+ * iso_3166.xml, to see how loading and lookups behave as the database
+ * grows. Output is deterministic for a given set of options.
+ *
+ * The defaults are roughly the size of the stock database, --scale
+ * multiplies the providers in each country. Point the library at the
+ * generated country names with MOBILE_PROVIDER_ISO_3166_CODES.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+/* Two letter codes, AA to ZZ */
+#define MAX_COUNTRIES (26 * 26)
+
+/* Every country gets its own MCC, starting at the first real one */
+#define FIRST_MCC 200
+
+static void
+country_code (gint country, gchar code[3])
+{
+	code[0] = 'A' + country / 26;
+	code[1] = 'A' + country % 26;
+	code[2] = '\0';
+}
+
+static gboolean
+write_iso_3166 (const gchar *filename, gint countries)
+{
+	gchar code[3];
+	FILE *file;
+	gint i;
+
+	file = g_fopen (filename, "w");
+	if (file == NULL) {
+		g_printerr ("Unable to write %s: %s\n", filename, g_strerror (errno));
+		return FALSE;
+	}
+
+	fprintf (file, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+	fprintf (file, "<iso_3166_entries>\n");
+
+	for (i = 0; i < countries; i++) {
+		country_code (i, code);
+		fprintf (file, "\t<iso_3166_entry\n"
+			       "\t\talpha_2_code=\"%s\"\n"
+			       "\t\talpha_3_code=\"%sX\"\n"
+			       "\t\tnumeric_code=\"%03d\"\n"
+			       "\t\tname=\"Synthetic Country %s\" />\n",
+			 code, code, i + 1, code);
+	}
+
+	fprintf (file, "</iso_3166_entries>\n");
+
+	if (fclose (file) != 0) {
+		g_printerr ("Unable to write %s: %s\n", filename, g_strerror (errno));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void
+write_provider (FILE *file,
+		const gchar *code,
+		gint country,
+		gint provider,
+		gint plans,
+		gint network_ids)
+{
+	gint i;
+
+	fprintf (file, "\t<provider>\n");
+	fprintf (file, "\t\t<name>Provider %s %d</name>\n", code, provider + 1);
+	fprintf (file, "\t\t<gsm>\n");
+
+	/* MNCs run on across the providers of a country */
+	for (i = 0; i < network_ids; i++)
+		fprintf (file, "\t\t\t<network-id mcc=\"%03d\" mnc=\"%03d\"/>\n",
+			 FIRST_MCC + country, (provider * network_ids + i) % 1000);
+
+	for (i = 0; i < plans; i++) {
+		fprintf (file, "\t\t\t<apn value=\"internet%d.provider%d.%c%c\">\n",
+			 i + 1, provider + 1, g_ascii_tolower (code[0]), g_ascii_tolower (code[1]));
+		fprintf (file, "\t\t\t\t<plan type=\"%s\"/>\n", i % 2 ? "prepaid" : "postpaid");
+		fprintf (file, "\t\t\t\t<usage type=\"internet\"/>\n");
+		fprintf (file, "\t\t\t\t<name>Plan %d</name>\n", i + 1);
+
+		/* Half the plans need credentials, like the real thing */
+		if (i % 2) {
+			fprintf (file, "\t\t\t\t<username>user%d</username>\n", i + 1);
+			fprintf (file, "\t\t\t\t<password>pass%d</password>\n", i + 1);
+		}
+
+		fprintf (file, "\t\t\t</apn>\n");
+	}
+
+	fprintf (file, "\t\t</gsm>\n");
+	fprintf (file, "\t</provider>\n");
+}
+
+static gboolean
+write_service_providers (const gchar *filename,
+			 gint countries,
+			 gint providers,
+			 gint plans,
+			 gint network_ids)
+{
+	gchar code[3];
+	FILE *file;
+	gint i, j;
+
+	file = g_fopen (filename, "w");
+	if (file == NULL) {
+		g_printerr ("Unable to write %s: %s\n", filename, g_strerror (errno));
+		return FALSE;
+	}
+
+	fprintf (file, "<?xml version=\"1.0\"?>\n");
+	fprintf (file, "<!DOCTYPE serviceproviders SYSTEM \"serviceproviders.2.dtd\">\n\n");
+	fprintf (file, "<serviceproviders format=\"2.0\">\n\n");
+
+	for (i = 0; i < countries; i++) {
+		country_code (i, code);
+		fprintf (file, "<country code=\"%c%c\">\n",
+			 g_ascii_tolower (code[0]), g_ascii_tolower (code[1]));
+
+		for (j = 0; j < providers; j++)
+			write_provider (file, code, i, j, plans, network_ids);
+
+		fprintf (file, "</country>\n\n");
+	}
+
+	fprintf (file, "</serviceproviders>\n");
+
+	if (fclose (file) != 0) {
+		g_printerr ("Unable to write %s: %s\n", filename, g_strerror (errno));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+gint
+main (gint argc, gchar **argv)
+{
+	GOptionContext *context;
+	GError *error = NULL;
+	gchar *output = NULL;
+	gchar *providers_file, *iso_file;
+	gint countries = 250;
+	gint providers = 4;
+	gint plans = 2;
+	gint network_ids = 3;
+	gint scale = 1;
+	gboolean ret;
+
+	GOptionEntry entries[] = {
+		{ "output", 'o', 0, G_OPTION_ARG_FILENAME, &output, "Directory for the generated files", "DIR" },
+		{ "countries", 'c', 0, G_OPTION_ARG_INT, &countries, "Number of countries (at most 676)", "N" },
+		{ "providers", 'p', 0, G_OPTION_ARG_INT, &providers, "Providers in each country", "N" },
+		{ "plans", 'l', 0, G_OPTION_ARG_INT, &plans, "Plans for each provider", "N" },
+		{ "network-ids", 'n', 0, G_OPTION_ARG_INT, &network_ids, "Network ids for each provider", "N" },
+		{ "scale", 's', 0, G_OPTION_ARG_INT, &scale, "Multiply the providers in each country", "N" },
+		{ NULL }
+	};
+
+	context = g_option_context_new ("- generate a synthetic mobile provider database");
+	g_option_context_add_main_entries (context, entries, NULL);
+
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("%s\n", error->message);
+		g_error_free (error);
+		return 1;
+	}
+	g_option_context_free (context);
+
+	if (countries < 1 || countries > MAX_COUNTRIES ||
+	    providers < 1 || plans < 0 || network_ids < 0 || scale < 1) {
+		g_printerr ("Counts out of range\n");
+		return 1;
+	}
+
+	if (output == NULL)
+		output = g_strdup (".");
+
+	if (g_mkdir_with_parents (output, 0755) < 0) {
+		g_printerr ("Unable to create %s: %s\n", output, g_strerror (errno));
+		return 1;
+	}
+
+	providers_file = g_build_filename (output, "serviceproviders.xml", NULL);
+	iso_file = g_build_filename (output, "iso_3166.xml", NULL);
+
+	ret = write_service_providers (providers_file, countries, providers * scale,
+				       plans, network_ids) &&
+	      write_iso_3166 (iso_file, countries);
+
+	if (ret)
+		g_print ("%s: %d countries, %d providers, %d plans\n%s\n",
+			 providers_file, countries, countries * providers * scale,
+			 countries * providers * scale * plans, iso_file);
+
+	g_free (iso_file);
+	g_free (providers_file);
+	g_free (output);
+
+	return ret ? 0 : 1;
+}
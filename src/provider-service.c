@@ -0,0 +1,284 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ *  Authors: Alok Barsode <alok.barsode@intel.com>
+ */
+
+/*
+ * Keeps the mobile provider database loaded and answers lookups for
+ * ofono-wizard and friends over D-Bus, so they don't have to parse
+ * the XML files on every start.
+ *
+ * The service never sets a locale: country names go out untranslated
+ * and clients translate them for themselves.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gi18n.h>
+
+#include "provider-database.h"
+#include "mobile-provider.h"
+
+#define PROVIDER_DATABASE_SERVICE "org.ofono.wizard.ProviderDatabase"
+#define PROVIDER_DATABASE_PATH "/org/ofono/wizard/ProviderDatabase"
+
+static GMainLoop *loop = NULL;
+
+static gboolean
+handle_get_countries (ProviderDatabase       *object,
+		      GDBusMethodInvocation  *invocation,
+		      MobileProviderDatabase *db)
+{
+	GVariantBuilder builder;
+	const gchar * const *countries;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ss)"));
+
+	countries = mobile_provider_database_get_countries (db);
+	for (; countries && *countries; countries++)
+		g_variant_builder_add (&builder, "(ss)",
+				       mobile_provider_database_get_code_from_country (db, *countries),
+				       *countries);
+
+	provider_database_complete_get_countries (object, invocation,
+						  g_variant_builder_end (&builder));
+	return TRUE;
+}
+
+static gboolean
+handle_get_providers (ProviderDatabase       *object,
+		      GDBusMethodInvocation  *invocation,
+		      const gchar            *country_code,
+		      MobileProviderDatabase *db)
+{
+	const gchar * const *providers;
+	const gchar *none[] = { NULL };
+
+	providers = mobile_provider_database_get_providers (db,
+							    mobile_provider_database_get_country_from_code (db, country_code));
+
+	provider_database_complete_get_providers (object, invocation, providers ? providers : none);
+	return TRUE;
+}
+
+static gboolean
+handle_get_plans (ProviderDatabase       *object,
+		  GDBusMethodInvocation  *invocation,
+		  const gchar            *country_code,
+		  const gchar            *provider,
+		  MobileProviderDatabase *db)
+{
+	const gchar * const *plans;
+	const gchar *none[] = { NULL };
+
+	plans = mobile_provider_database_get_plans (db,
+						    mobile_provider_database_get_country_from_code (db, country_code),
+						    provider);
+
+	provider_database_complete_get_plans (object, invocation, plans ? plans : none);
+	return TRUE;
+}
+
+static gboolean
+handle_get_plan_info (ProviderDatabase       *object,
+		      GDBusMethodInvocation  *invocation,
+		      const gchar            *country_code,
+		      const gchar            *provider,
+		      const gchar            *plan,
+		      MobileProviderDatabase *db)
+{
+	const PlanInfo *info;
+
+	info = mobile_provider_database_get_plan_info (db,
+						       mobile_provider_database_get_country_from_code (db, country_code),
+						       provider, plan);
+	if (info == NULL) {
+		g_dbus_method_invocation_return_dbus_error (invocation,
+							    PROVIDER_DATABASE_SERVICE ".Error.NotFound",
+							    "No such plan");
+		return TRUE;
+	}
+
+	provider_database_complete_get_plan_info (object, invocation,
+						  info->apn,
+						  info->username ? info->username : "",
+						  info->password ? info->password : "");
+	return TRUE;
+}
+
+static gboolean
+handle_get_mms_info (ProviderDatabase       *object,
+		     GDBusMethodInvocation  *invocation,
+		     const gchar            *country_code,
+		     const gchar            *provider,
+		     MobileProviderDatabase *db)
+{
+	const PlanInfo *info;
+
+	info = mobile_provider_database_get_mms_info (db,
+						      mobile_provider_database_get_country_from_code (db, country_code),
+						      provider);
+	if (info == NULL) {
+		g_dbus_method_invocation_return_dbus_error (invocation,
+							    PROVIDER_DATABASE_SERVICE ".Error.NotFound",
+							    "No MMS settings");
+		return TRUE;
+	}
+
+	provider_database_complete_get_mms_info (object, invocation,
+						 info->apn,
+						 info->username ? info->username : "",
+						 info->password ? info->password : "",
+						 info->mmsc ? info->mmsc : "",
+						 info->mmsproxy ? info->mmsproxy : "");
+	return TRUE;
+}
+
+static gboolean
+handle_get_country_code_from_mcc (ProviderDatabase       *object,
+				  GDBusMethodInvocation  *invocation,
+				  const gchar            *mcc,
+				  MobileProviderDatabase *db)
+{
+	const gchar *code;
+
+	code = mobile_provider_database_get_country_code_from_mcc (db, mcc);
+	if (code == NULL) {
+		g_dbus_method_invocation_return_dbus_error (invocation,
+							    PROVIDER_DATABASE_SERVICE ".Error.NotFound",
+							    "Unknown MCC");
+		return TRUE;
+	}
+
+	provider_database_complete_get_country_code_from_mcc (object, invocation, code);
+	return TRUE;
+}
+
+static void
+on_bus_acquired (GDBusConnection *connection,
+		 const gchar     *name,
+		 gpointer         user_data)
+{
+	ProviderDatabase *skeleton = user_data;
+	GError *error = NULL;
+
+	if (!g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (skeleton),
+					       connection,
+					       PROVIDER_DATABASE_PATH,
+					       &error)) {
+		g_warning ("Unable to export the provider database: %s", error->message);
+		g_error_free (error);
+		g_main_loop_quit (loop);
+	}
+}
+
+static void
+on_name_lost (GDBusConnection *connection,
+	      const gchar     *name,
+	      gpointer         user_data)
+{
+	g_warning ("Lost the name %s on the bus", name);
+	g_main_loop_quit (loop);
+}
+
+gint
+main (gint argc, gchar **argv)
+{
+	MobileProviderDatabase *db;
+	ProviderDatabase *skeleton;
+	GOptionContext *context;
+	GError *error = NULL;
+	gchar **databases = NULL;
+	gboolean stats = FALSE;
+	guint owner_id;
+
+	GOptionEntry entries[] = {
+		{ "database", 'd', 0, G_OPTION_ARG_FILENAME_ARRAY, &databases,
+		  "Provider database, repeat to layer overlays in order", "FILE" },
+		{ "stats", 0, 0, G_OPTION_ARG_NONE, &stats,
+		  "Print the memory used by the provider database and exit", NULL },
+		{ NULL }
+	};
+
+#if !GLIB_CHECK_VERSION (2, 35, 0)
+	g_type_init ();
+#endif
+
+	context = g_option_context_new ("- serve mobile provider lookups over D-Bus");
+	g_option_context_add_main_entries (context, entries, NULL);
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_warning ("%s", error->message);
+		g_error_free (error);
+		return 1;
+	}
+	g_option_context_free (context);
+
+	db = mobile_provider_database_new_for_files ((const gchar * const *) databases,
+						     MOBILE_PROVIDER_DATABASE_FLAGS_NONE,
+						     &error);
+	g_strfreev (databases);
+	if (db == NULL) {
+		g_warning ("Unable to load the mobile provider database: %s", error->message);
+		g_error_free (error);
+		return 1;
+	}
+
+	if (stats) {
+		mobile_provider_database_print_stats (db);
+		mobile_provider_database_unref (db);
+		return 0;
+	}
+
+	loop = g_main_loop_new (NULL, FALSE);
+
+	skeleton = provider_database_skeleton_new ();
+	g_signal_connect (skeleton, "handle-get-countries",
+			  G_CALLBACK (handle_get_countries), db);
+	g_signal_connect (skeleton, "handle-get-providers",
+			  G_CALLBACK (handle_get_providers), db);
+	g_signal_connect (skeleton, "handle-get-plans",
+			  G_CALLBACK (handle_get_plans), db);
+	g_signal_connect (skeleton, "handle-get-plan-info",
+			  G_CALLBACK (handle_get_plan_info), db);
+	g_signal_connect (skeleton, "handle-get-mms-info",
+			  G_CALLBACK (handle_get_mms_info), db);
+	g_signal_connect (skeleton, "handle-get-country-code-from-mcc",
+			  G_CALLBACK (handle_get_country_code_from_mcc), db);
+
+	owner_id = g_bus_own_name (G_BUS_TYPE_SYSTEM,
+				   PROVIDER_DATABASE_SERVICE,
+				   G_BUS_NAME_OWNER_FLAGS_NONE,
+				   on_bus_acquired,
+				   NULL,
+				   on_name_lost,
+				   skeleton,
+				   NULL);
+
+	g_main_loop_run (loop);
+
+	g_bus_unown_name (owner_id);
+	g_object_unref (skeleton);
+	g_main_loop_unref (loop);
+
+	mobile_provider_database_unref (db);
+
+	return 0;
+}